@@ -0,0 +1,157 @@
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#include "PointCloudGridEncoder.hpp"
+#include "BinaryFile.hpp"
+
+/**
+ * Number of calls to global operator new since program start.
+*/
+std::atomic<size_t> num_allocations(0);
+
+void* operator new(size_t size)
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+struct Config {
+    const char* name;
+    bool irrelevance_coding;
+    bool entropy_coding;
+    EntropyBackend entropy_backend;
+    GeometryCoding geometry_coding;
+    bool progressive_ordering;
+    unsigned keyframe_interval;
+    bool cell_caching;
+    bool cell_offset_table;
+    bool roi;
+};
+
+/**
+ * Encodes and decodes the same point cloud repeatedly with encodeInto
+ * and decode from raw memory, counting heap allocations per frame
+ * after a number of warm up frames.
+ * Usage: bench_alloc [voxel_file] [frames]
+ * Returns 1 if any frame after warm up allocates memory.
+*/
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "./voxel_log.txt";
+    int num_frames = argc > 2 ? atoi(argv[2]) : 8;
+
+    BinaryFile file;
+    if(!file.read(path)) {
+        std::cout << "NOTIFICATION: could not read " << path << std::endl;
+        return 1;
+    }
+    std::vector<UncompressedVoxel> point_cloud(file.getSize() / sizeof(UncompressedVoxel));
+    file.copy(reinterpret_cast<char*>(point_cloud.data()));
+
+    BoundingBox bb(Vec<float>(-1.0f, 0.0f, -1.0f), Vec<float>(1.0f, 2.2f, 1.0f));
+    const Config configs[] = {
+        {"packed",           true,  false, ENTROPY_ZLIB,  GEOMETRY_PACKED, false, 0, false, false, false},
+        {"packed overlap",   false, false, ENTROPY_ZLIB,  GEOMETRY_PACKED, false, 0, false, false, false},
+        {"zlib",             true,  true,  ENTROPY_ZLIB,  GEOMETRY_PACKED, false, 0, false, false, false},
+        {"lz",               true,  true,  ENTROPY_LZ,    GEOMETRY_PACKED, false, 0, false, false, false},
+        {"store",            true,  true,  ENTROPY_STORE, GEOMETRY_PACKED, false, 0, false, false, false},
+        {"zlib delta",       true,  true,  ENTROPY_ZLIB,  GEOMETRY_PACKED, false, 4, false, false, false},
+        {"zlib cache table", true,  true,  ENTROPY_ZLIB,  GEOMETRY_PACKED, false, 0, true,  true,  false},
+        {"zlib roi",         true,  true,  ENTROPY_ZLIB,  GEOMETRY_PACKED, false, 0, false, true,  true},
+        {"octree",           true,  false, ENTROPY_ZLIB,  GEOMETRY_OCTREE, false, 0, false, false, false},
+        {"octree zlib",      true,  true,  ENTROPY_ZLIB,  GEOMETRY_OCTREE, false, 0, false, false, false},
+        {"range",            true,  true,  ENTROPY_RANGE, GEOMETRY_PACKED, false, 0, false, false, false},
+        {"range cache",      true,  true,  ENTROPY_RANGE, GEOMETRY_PACKED, false, 0, true,  false, false},
+        {"progressive",      true,  false, ENTROPY_ZLIB,  GEOMETRY_PACKED, true,  0, false, false, false},
+        {"progressive zlib", true,  true,  ENTROPY_ZLIB,  GEOMETRY_PACKED, true,  0, false, false, false}
+    };
+
+    std::cout << "points: " << point_cloud.size() << ", frames: " << num_frames << std::endl;
+    std::cout << "config           | warm up allocations | allocations per frame\n";
+    bool allocation_free = true;
+    for(const Config& config : configs) {
+        PointCloudGridEncoder encoder, decoder;
+        encoder.settings.grid_precision = GridPrecisionDescriptor(Vec8(8,8,8), bb,
+            Vec<BitCount>(BIT_6,BIT_6,BIT_6), Vec<BitCount>(BIT_5,BIT_5,BIT_5));
+        encoder.settings.irrelevance_coding = config.irrelevance_coding;
+        encoder.settings.entropy_coding = config.entropy_coding;
+        encoder.settings.entropy_backend = config.entropy_backend;
+        encoder.settings.geometry_coding = config.geometry_coding;
+        encoder.settings.progressive_ordering = config.progressive_ordering;
+        encoder.settings.keyframe_interval = config.keyframe_interval;
+        encoder.settings.cell_caching = config.cell_caching;
+        encoder.settings.cell_offset_table = config.cell_offset_table;
+        decoder.settings = encoder.settings;
+
+        std::vector<unsigned char> msg(encoder.calcMaxMessageSize(point_cloud.size()));
+        std::vector<UncompressedVoxel> decoded;
+        BoundingBox roi(Vec<float>(-1.0f, 0.0f, -1.0f), Vec<float>(0.0f, 1.1f, 0.0f));
+
+        // a keyframe cycle covers all frame shapes of a sequence
+        int num_warm_up = std::max<int>(2, static_cast<int>(config.keyframe_interval));
+        size_t warm_up_allocations = 0;
+        size_t steady_allocations = 0;
+        bool valid = true;
+        for(int frame = 0; frame < num_warm_up + num_frames; ++frame) {
+            size_t before = num_allocations.load();
+            size_t size = encoder.encodeInto(point_cloud, msg.data(), msg.size());
+            if(config.roi)
+                valid = decoder.decode(msg.data(), size, &decoded, roi) && valid;
+            else
+                valid = decoder.decode(msg.data(), size, &decoded) && valid;
+            size_t allocations = num_allocations.load() - before;
+            if(frame < num_warm_up)
+                warm_up_allocations += allocations;
+            else
+                steady_allocations += allocations;
+        }
+
+        allocation_free = allocation_free && valid && steady_allocations == 0;
+        std::cout << std::left << std::setw(16) << config.name << " | "
+                  << std::right << std::setw(19) << warm_up_allocations << " | "
+                  << std::setw(21) << static_cast<double>(steady_allocations) / num_frames
+                  << (valid ? "" : " (decoding failed)") << std::endl;
+    }
+    return allocation_free ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "PointCloudGridEncoder.hpp"
+#include "BinaryFile.hpp"
+#include "Measure.hpp"
+
+/**
+ * Splits the voxel file into many small clouds, each with a grid precision
+ * fitted to its bounding box, and encodes them repeatedly, once using
+ * an encoder per cloud and once using PointCloudGridEncoder::encodeBatch.
+ * Compares the messages and prints the throughput of both.
+ * Usage: bench_batch [voxel_file] [points_per_cloud] [rounds]
+ * Returns 1 if messages differ.
+*/
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "./voxel_log.txt";
+    size_t cloud_size = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 500;
+    int num_rounds = argc > 3 ? atoi(argv[3]) : 8;
+
+    BinaryFile file;
+    if(!file.read(path) || cloud_size == 0) {
+        std::cout << "NOTIFICATION: could not read " << path << std::endl;
+        return 1;
+    }
+    std::vector<UncompressedVoxel> point_cloud(file.getSize() / sizeof(UncompressedVoxel));
+    file.copy(reinterpret_cast<char*>(point_cloud.data()));
+
+    size_t num_clouds = (point_cloud.size() + cloud_size - 1) / cloud_size;
+    std::vector<std::vector<UncompressedVoxel>> clouds(num_clouds);
+    std::vector<GridPrecisionDescriptor> precisions(num_clouds);
+    std::vector<PointCloudGridEncoder::BatchCloud> batch(num_clouds);
+    for(size_t i = 0; i < num_clouds; ++i) {
+        auto begin = point_cloud.begin() + i * cloud_size;
+        auto end = point_cloud.begin() + std::min(point_cloud.size(), (i + 1) * cloud_size);
+        clouds[i].assign(begin, end);
+        Vec<float> min(clouds[i][0].pos[0], clouds[i][0].pos[1], clouds[i][0].pos[2]);
+        Vec<float> max(min);
+        for(const UncompressedVoxel& v : clouds[i]) {
+            min = Vec<float>(std::min(min.x, v.pos[0]), std::min(min.y, v.pos[1]), std::min(min.z, v.pos[2]));
+            max = Vec<float>(std::max(max.x, v.pos[0]), std::max(max.y, v.pos[1]), std::max(max.z, v.pos[2]));
+        }
+        max = Vec<float>(max.x + 0.001f, max.y + 0.001f, max.z + 0.001f);
+        precisions[i] = GridPrecisionDescriptor(Vec8(2,2,2), BoundingBox(min, max),
+            Vec<BitCount>(BIT_6,BIT_6,BIT_6), Vec<BitCount>(BIT_5,BIT_5,BIT_5));
+        batch[i] = PointCloudGridEncoder::BatchCloud(&clouds[i], &precisions[i]);
+    }
+
+    PointCloudGridEncoder::EncodingSettings settings;
+    std::vector<std::unique_ptr<PointCloudGridEncoder>> encoders(num_clouds);
+    for(size_t i = 0; i < num_clouds; ++i) {
+        encoders[i].reset(new PointCloudGridEncoder(settings));
+        encoders[i]->settings.grid_precision = precisions[i];
+    }
+    std::vector<zmq::message_t> single(num_clouds);
+    Measure t;
+    t.startWatch();
+    for(int round = 0; round < num_rounds; ++round) {
+        for(size_t i = 0; i < num_clouds; ++i)
+            single[i] = encoders[i]->encode(clouds[i]);
+    }
+    time_t single_time = t.stopWatch();
+
+    std::vector<zmq::message_t> batched;
+    PointCloudGridEncoder batch_encoder(settings);
+    bool success = true;
+    t.startWatch();
+    for(int round = 0; round < num_rounds; ++round)
+        success = batch_encoder.encodeBatch(batch, batched) && success;
+    time_t batch_time = t.stopWatch();
+
+    bool equal = success && batched.size() == single.size();
+    for(size_t i = 0; equal && i < batched.size(); ++i) {
+        equal = batched[i].size() == single[i].size() &&
+                memcmp(batched[i].data(), single[i].data(), batched[i].size()) == 0;
+    }
+
+    std::cout << "clouds: " << num_clouds << " x " << cloud_size << " points, rounds: " << num_rounds << std::endl;
+    std::cout << "  > encode:      " << single_time << "ms" << std::endl;
+    std::cout << "  > encodeBatch: " << batch_time << "ms" << std::endl;
+    std::cout << "  > messages " << (equal ? "equal" : "DIFFER") << std::endl;
+    return equal ? 0 : 1;
+}
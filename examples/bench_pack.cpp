@@ -0,0 +1,203 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <random>
+
+#include "BitVecArray.hpp"
+#include "BitPacker.hpp"
+#include "PackKernels.hpp"
+
+/**
+ * Reference implementation of BitVecArray::pack prior to BitPacker.
+ * Every bit is copied separately using a std::bitset<8>
+ * and the BitValue interface of a BitVec.
+*/
+unsigned char* packBitwise(const BitVecArray& arr)
+{
+    BitCount nx = arr.getNX(), ny = arr.getNY(), nz = arr.getNZ();
+    auto* packed_data = new unsigned char[arr.getByteSize()];
+    std::bitset<8> byte;
+    size_t current_byte = 0;
+    size_t bit_idx = 0;
+    BitVec bit_vec(0,0,0,nx,ny,nz);
+    const AbstractBitValue* comps[3];
+    size_t comp_bits[3] = {nx, ny, nz};
+    for(unsigned e = 0; e < arr.size(); ++e) {
+        bit_vec.setX(arr[e].x);
+        bit_vec.setY(arr[e].y);
+        bit_vec.setZ(arr[e].z);
+        comps[0] = bit_vec.getX();
+        comps[1] = bit_vec.getY();
+        comps[2] = bit_vec.getZ();
+        for(unsigned c = 0; c < 3; ++c) {
+            for(size_t i = 0; i < comp_bits[c]; ++i) {
+                byte[bit_idx] = comps[c]->getBit(i);
+                bit_idx = (bit_idx + 1) % 8;
+                if(bit_idx == 0)
+                    packed_data[current_byte++] = static_cast<unsigned char>(byte.to_ulong());
+            }
+        }
+    }
+    if(bit_idx != 0) {
+        while(bit_idx != 0) {
+            byte[bit_idx] = false;
+            bit_idx = (bit_idx + 1) % 8;
+        }
+        packed_data[current_byte] = static_cast<unsigned char>(byte.to_ulong());
+    }
+    return packed_data;
+}
+
+/**
+ * Reference implementation of BitVecArray::unpack prior to BitUnpacker.
+*/
+void unpackBitwise(BitVecArray& arr, const unsigned char* packed_data, size_t num_elmnts)
+{
+    BitCount nx = arr.getNX(), ny = arr.getNY(), nz = arr.getNZ();
+    arr.clear();
+    arr.resize(static_cast<unsigned>(num_elmnts));
+    size_t elmt_idx = 0;
+    size_t elmt_size = nx+ny+nz;
+    size_t current_bit = 0;
+    std::bitset<8> byte;
+    BitVec bit_vec(0,0,0,nx,ny,nz);
+    for(size_t i = 0; i < arr.getByteSize() && elmt_idx < num_elmnts; ++i) {
+        byte = std::bitset<8>(static_cast<unsigned long>(packed_data[i]));
+        for(size_t byte_idx = 0; byte_idx < byte.size(); ++byte_idx) {
+            if(current_bit < nx)
+                bit_vec.setX(current_bit, byte[byte_idx]);
+            else if(current_bit < (size_t) nx+ny)
+                bit_vec.setY(current_bit-nx, byte[byte_idx]);
+            else
+                bit_vec.setZ(current_bit-nx-ny, byte[byte_idx]);
+            current_bit = (current_bit + 1) % elmt_size;
+            if(current_bit == 0) {
+                arr.set(static_cast<unsigned>(elmt_idx),
+                        Vec<uint64_t>(bit_vec.getXInt(), bit_vec.getYInt(), bit_vec.getZInt()));
+                if(++elmt_idx == num_elmnts)
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * Generic word-level packing without kernels specialized per BitCount triple.
+*/
+void packWordwise(const BitVecArray& arr, unsigned char* packed_data)
+{
+    BitPacker packer(packed_data);
+    for(unsigned i = 0; i < arr.size(); ++i) {
+        packer.write(arr[i].x, arr.getNX());
+        packer.write(arr[i].y, arr.getNY());
+        packer.write(arr[i].z, arr.getNZ());
+    }
+    packer.flush();
+}
+
+/**
+ * Generic word-level unpacking without kernels specialized per BitCount triple.
+*/
+void unpackWordwise(BitVecArray& arr, const unsigned char* packed_data, size_t num_elmnts)
+{
+    arr.clear();
+    arr.resize(static_cast<unsigned>(num_elmnts));
+    BitUnpacker unpacker(packed_data, arr.getByteSize());
+    Vec<uint64_t> v;
+    for(unsigned i = 0; i < num_elmnts; ++i) {
+        v.x = unpacker.read(arr.getNX());
+        v.y = unpacker.read(arr.getNY());
+        v.z = unpacker.read(arr.getNZ());
+        arr.set(i, v);
+    }
+}
+
+template <typename F>
+double measureMBs(F f, size_t bytes, int reps)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int r = 0; r < reps; ++r)
+        f();
+    double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return static_cast<double>(bytes) * reps / 1000000.0 / secs;
+}
+
+bool equalElements(const BitVecArray& a, const BitVecArray& b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(unsigned i = 0; i < a.size(); ++i) {
+        if(a[i].x != b[i].x || a[i].y != b[i].y || a[i].z != b[i].z)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Compares throughput of bitwise packing, generic word-level packing
+ * and BitVecArray::pack/unpack (using kernels specialized per BitCount triple
+ * where available) for every BitCount in [1,32] (applied to all components).
+ * Results of all implementations are checked for equality.
+ * Usage: bench_pack [num_elements] [repetitions]
+*/
+int main(int argc, char* argv[]) {
+    size_t num_elmnts = argc > 1 ? static_cast<size_t>(atol(argv[1])) : 100000;
+    int reps = argc > 2 ? atoi(argv[2]) : 3;
+
+    std::mt19937_64 rng(42);
+    std::cout << "elements: " << num_elmnts << ", repetitions: " << reps << ", throughput in MB/s\n";
+    std::cout << "bits | kernel | pack bitwise | pack word | pack array | unpack bitwise | unpack word | unpack array | equal\n";
+
+    for(int n = BIT_1; n <= BIT_32; ++n) {
+        auto N = static_cast<BitCount>(n);
+        BitVecArray arr(N, N, N);
+        uint64_t mask = (uint64_t(1) << n) - 1;
+        for(size_t i = 0; i < num_elmnts; ++i)
+            arr.emplace_back(rng() & mask, rng() & mask, rng() & mask);
+
+        size_t bytes = arr.getByteSize();
+        auto* packed_word = new unsigned char[bytes];
+        auto* packed_array = new unsigned char[bytes];
+        unsigned char* packed_bitwise = nullptr;
+
+        double pack_bitwise = measureMBs([&]() {
+            delete [] packed_bitwise;
+            packed_bitwise = packBitwise(arr);
+        }, bytes, reps);
+        double pack_word = measureMBs([&]() { packWordwise(arr, packed_word); }, bytes, reps);
+        double pack_array = measureMBs([&]() { arr.pack(packed_array); }, bytes, reps);
+
+        bool equal = memcmp(packed_word, packed_bitwise, bytes) == 0 &&
+                     memcmp(packed_array, packed_bitwise, bytes) == 0;
+
+        BitVecArray unpacked_bitwise(N, N, N), unpacked_word(N, N, N), unpacked_array(N, N, N);
+        double unpack_bitwise = measureMBs([&]() {
+            unpackBitwise(unpacked_bitwise, packed_bitwise, num_elmnts);
+        }, bytes, reps);
+        double unpack_word = measureMBs([&]() {
+            unpackWordwise(unpacked_word, packed_bitwise, num_elmnts);
+        }, bytes, reps);
+        double unpack_array = measureMBs([&]() {
+            unpacked_array.unpack(packed_bitwise, num_elmnts);
+        }, bytes, reps);
+
+        equal = equal && equalElements(arr, unpacked_bitwise) &&
+                equalElements(arr, unpacked_word) && equalElements(arr, unpacked_array);
+
+        std::cout << std::setw(4) << n << " | "
+                  << std::setw(6) << (findPackKernels(N, N, N) != nullptr ? "yes" : "no") << " | "
+                  << std::setw(12) << pack_bitwise << " | "
+                  << std::setw(9) << pack_word << " | "
+                  << std::setw(10) << pack_array << " | "
+                  << std::setw(14) << unpack_bitwise << " | "
+                  << std::setw(11) << unpack_word << " | "
+                  << std::setw(12) << unpack_array << " | "
+                  << (equal ? "yes" : "NO") << std::endl;
+
+        delete [] packed_word;
+        delete [] packed_array;
+        delete [] packed_bitwise;
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "PointCloudStreamEncoder.hpp"
+#include "BinaryFile.hpp"
+#include "Measure.hpp"
+
+/**
+ * Encodes a sequence of frames once with PointCloudGridEncoder::encode
+ * and once with PointCloudStreamEncoder, compares the messages and prints
+ * the throughput of both. Frames differ in the number of points taken
+ * from the voxel file, such that delta frames contain changed cells.
+ * Usage: bench_stream [voxel_file] [frames] [keyframe_interval]
+ * Returns 1 if messages differ.
+*/
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "./voxel_log.txt";
+    int num_frames = argc > 2 ? atoi(argv[2]) : 32;
+    unsigned keyframe_interval = argc > 3 ? static_cast<unsigned>(atoi(argv[3])) : 4;
+
+    BinaryFile file;
+    if(!file.read(path)) {
+        std::cout << "NOTIFICATION: could not read " << path << std::endl;
+        return 1;
+    }
+    std::vector<UncompressedVoxel> point_cloud(file.getSize() / sizeof(UncompressedVoxel));
+    file.copy(reinterpret_cast<char*>(point_cloud.data()));
+
+    PointCloudGridEncoder::EncodingSettings settings;
+    BoundingBox bb(Vec<float>(-1.0f, 0.0f, -1.0f), Vec<float>(1.0f, 2.2f, 1.0f));
+    settings.grid_precision = GridPrecisionDescriptor(Vec8(8,8,8), bb,
+        Vec<BitCount>(BIT_6,BIT_6,BIT_6), Vec<BitCount>(BIT_5,BIT_5,BIT_5));
+    settings.keyframe_interval = keyframe_interval;
+    auto frameSize = [&point_cloud](int frame) {
+        return static_cast<int>(point_cloud.size()) - (frame % 8) * 1000;
+    };
+
+    std::vector<zmq::message_t> sequential(num_frames);
+    PointCloudGridEncoder encoder(settings);
+    Measure t;
+    t.startWatch();
+    for(int frame = 0; frame < num_frames; ++frame)
+        sequential[frame] = encoder.encode(point_cloud, frameSize(frame));
+    time_t sequential_time = t.stopWatch();
+
+    std::vector<zmq::message_t> streamed;
+    PointCloudStreamEncoder stream_encoder(settings);
+    t.startWatch();
+    std::thread producer([&] {
+        for(int frame = 0; frame < num_frames; ++frame)
+            stream_encoder.push(point_cloud, frameSize(frame));
+        stream_encoder.close();
+    });
+    zmq::message_t msg;
+    while(stream_encoder.pop(msg))
+        streamed.push_back(std::move(msg));
+    producer.join();
+    time_t stream_time = t.stopWatch();
+
+    bool equal = streamed.size() == sequential.size();
+    for(size_t i = 0; equal && i < streamed.size(); ++i) {
+        equal = streamed[i].size() == sequential[i].size() &&
+                memcmp(streamed[i].data(), sequential[i].data(), streamed[i].size()) == 0;
+    }
+
+    std::cout << "points: " << point_cloud.size() << ", frames: " << num_frames
+              << ", keyframe interval: " << keyframe_interval
+              << ", threads: " << ThreadPool::getDefault().getNumThreads() << std::endl;
+    std::cout << "  > encode:         " << sequential_time << "ms" << std::endl;
+    std::cout << "  > stream encoder: " << stream_time << "ms" << std::endl;
+    std::cout << "  > messages " << (equal ? "equal" : "DIFFER") << std::endl;
+    return equal ? 0 : 1;
+}
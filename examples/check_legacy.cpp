@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "PointCloudGridEncoder.hpp"
+#include "BinaryFile.hpp"
+
+/**
+ * Message written by the original unversioned encoder along with
+ * the number of points and hash of the points its decoder extracted.
+*/
+struct LegacyMessage {
+    const char* file_name;
+    size_t num_points;
+    uint64_t hash;
+    const char* appendix;
+};
+
+/**
+ * Every 50th voxel of voxel_log.txt in a 4x4x4 grid with 6 bit positions and 5 bit colors,
+ * encoded without irrelevance & entropy coding plus appendix, and with both.
+*/
+const LegacyMessage LEGACY_MESSAGES[] = {
+    {"legacy_raw.msg", 3021, 0x764b8d59c91d6d18ull, "legacy"},
+    {"legacy_zlib.msg", 2907, 0x4e0235c647d58fb5ull, ""}
+};
+
+/**
+ * FNV-1a hash of the voxels in byte order, independent of their order in point_cloud.
+*/
+uint64_t hashVoxels(std::vector<UncompressedVoxel> point_cloud)
+{
+    std::sort(point_cloud.begin(), point_cloud.end(), [](const UncompressedVoxel& a, const UncompressedVoxel& b) {
+        return memcmp(&a, &b, sizeof(UncompressedVoxel)) < 0;
+    });
+    uint64_t hash = 1469598103934665603ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(point_cloud.data());
+    for(size_t i = 0; i < point_cloud.size() * sizeof(UncompressedVoxel); ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+/**
+ * Decodes messages of FORMAT_VERSION_LEGACY written by the original encoder
+ * and compares the points to those extracted by the original decoder.
+ * Usage: check_legacy [directory of legacy_*.msg]
+ * Returns 1 if a message is not decoded identically.
+*/
+int main(int argc, char* argv[]) {
+    std::string dir = argc > 1 ? std::string(argv[1]) + "/" : "./";
+
+    bool all_equal = true;
+    for(const LegacyMessage& legacy : LEGACY_MESSAGES) {
+        std::string path = dir + legacy.file_name;
+        BinaryFile file;
+        if(!file.read(path)) {
+            std::cout << "NOTIFICATION: could not read " << path << std::endl;
+            return 1;
+        }
+        zmq::message_t msg(file.getSize());
+        file.copy(static_cast<char*>(msg.data()));
+
+        PointCloudGridEncoder decoder;
+        std::vector<UncompressedVoxel> point_cloud;
+        bool success = decoder.decode(msg, &point_cloud);
+        std::string appendix;
+        decoder.readFromAppendix(msg, appendix);
+        bool equal = success && point_cloud.size() == legacy.num_points &&
+                     hashVoxels(point_cloud) == legacy.hash && appendix == legacy.appendix;
+        all_equal = all_equal && equal;
+
+        std::cout << legacy.file_name << ": " << point_cloud.size() << " points, "
+                  << (equal ? "equal" : "DIFFER") << std::endl;
+    }
+    return all_equal ? 0 : 1;
+}
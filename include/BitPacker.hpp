@@ -0,0 +1,130 @@
+#ifndef LIBPCC_BIT_PACKER_HPP
+#define LIBPCC_BIT_PACKER_HPP
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * Writes values of up to 32 bits into a byte array.
+ * Values are shifted into a 64 bit accumulator, which is flushed
+ * to the output whenever a whole word has been filled.
+ * Bits are written least significant bit first, beginning at bit 0
+ * of the first byte. This matches the layout of BitVecArray messages.
+*/
+class BitPacker {
+public:
+    explicit BitPacker(unsigned char* t_out)
+        : begin_(t_out)
+        , out_(t_out)
+        , acc_(0)
+        , fill_(0)
+    {}
+
+    /**
+     * Appends the lower 'bits' bits of value to the output.
+     * bits has to be in range [1,32].
+    */
+    void write(uint64_t value, unsigned bits)
+    {
+        value &= (uint64_t(1) << bits) - 1;
+        acc_ |= value << fill_;
+        fill_ += bits;
+        if(fill_ >= 64) {
+            storeWord(out_, acc_);
+            out_ += 8;
+            fill_ -= 64;
+            acc_ = fill_ == 0 ? 0 : value >> (bits - fill_);
+        }
+    }
+
+    /**
+     * Writes all pending bits to the output.
+     * The last byte is padded with zero bits if necessary.
+     * Returns the total number of bytes written.
+    */
+    size_t flush()
+    {
+        while(fill_ > 0) {
+            *out_++ = static_cast<unsigned char>(acc_);
+            acc_ >>= 8;
+            fill_ = fill_ > 8 ? fill_ - 8 : 0;
+        }
+        return static_cast<size_t>(out_ - begin_);
+    }
+
+private:
+    static void storeWord(unsigned char* out, uint64_t w)
+    {
+        for(unsigned i = 0; i < 8; ++i)
+            out[i] = static_cast<unsigned char>(w >> (8*i));
+    }
+
+    unsigned char* begin_;
+    unsigned char* out_;
+    uint64_t acc_;
+    unsigned fill_;
+};
+
+/**
+ * Reads values of up to 32 bits from a byte array written by BitPacker.
+ * Input is loaded word wise into a 64 bit accumulator
+ * and only read byte wise at the end of the given range.
+*/
+class BitUnpacker {
+public:
+    BitUnpacker(const unsigned char* t_in, size_t size)
+        : in_(t_in)
+        , end_(t_in + size)
+        , acc_(0)
+        , avail_(0)
+    {}
+
+    /**
+     * Returns the next 'bits' bits from the input.
+     * bits has to be in range [1,32].
+     * Reading past the end of input yields zero bits.
+    */
+    uint64_t read(unsigned bits)
+    {
+        if(avail_ < bits)
+            refill();
+        uint64_t value = acc_ & ((uint64_t(1) << bits) - 1);
+        acc_ >>= bits;
+        avail_ = avail_ > bits ? avail_ - bits : 0;
+        return value;
+    }
+
+private:
+    void refill()
+    {
+        if(end_ - in_ >= 8) {
+            // bits loaded beyond avail_ equal those loaded by the next refill,
+            // thus they do not have to be masked out.
+            acc_ |= loadWord(in_) << avail_;
+            unsigned num_bytes = (63 - avail_) >> 3;
+            in_ += num_bytes;
+            avail_ += num_bytes << 3;
+        }
+        else {
+            while(avail_ <= 56 && in_ < end_) {
+                acc_ |= static_cast<uint64_t>(*in_++) << avail_;
+                avail_ += 8;
+            }
+        }
+    }
+
+    static uint64_t loadWord(const unsigned char* in)
+    {
+        uint64_t w = 0;
+        for(unsigned i = 0; i < 8; ++i)
+            w |= static_cast<uint64_t>(in[i]) << (8*i);
+        return w;
+    }
+
+    const unsigned char* in_;
+    const unsigned char* end_;
+    uint64_t acc_;
+    unsigned avail_;
+};
+
+#endif //LIBPCC_BIT_PACKER_HPP
@@ -6,10 +6,67 @@
 #include <cmath>
 
 /**
- * Container storing vector of BitVec instances with similar component precisions.
+ * Structure of arrays storing x, y & z - components
+ * of quantized values in separate arrays of component type C.
+*/
+template <typename C>
+struct ComponentArrays {
+    size_t size() const
+    {
+        return x.size();
+    }
+
+    void resize(size_t s)
+    {
+        x.resize(s);
+        y.resize(s);
+        z.resize(s);
+    }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+    }
+
+    Vec<uint64_t> const get(size_t i) const
+    {
+        return Vec<uint64_t>(x[i], y[i], z[i]);
+    }
+
+    void set(size_t i, uint64_t t_x, uint64_t t_y, uint64_t t_z)
+    {
+        x[i] = static_cast<C>(t_x);
+        y[i] = static_cast<C>(t_y);
+        z[i] = static_cast<C>(t_z);
+    }
+
+    void push_back(uint64_t t_x, uint64_t t_y, uint64_t t_z)
+    {
+        x.push_back(static_cast<C>(t_x));
+        y.push_back(static_cast<C>(t_y));
+        z.push_back(static_cast<C>(t_z));
+    }
+
+    std::vector<C> x;
+    std::vector<C> y;
+    std::vector<C> z;
+};
+
+/**
+ * Container storing quantized vectors with similar component precisions.
+ * Components are held in a structure of arrays. uint16_t is used as
+ * component type if no precision exceeds BitVecArray::MAX_NARROW_BITS,
+ * uint32_t otherwise.
 */
 class BitVecArray {
 public:
+    /**
+     * Largest component precision stored in uint16_t arrays.
+    */
+    static const unsigned MAX_NARROW_BITS = 16;
+
     explicit BitVecArray(BitCount t_NX=BIT_8, BitCount t_NY=BIT_8, BitCount t_NZ=BIT_8);
 
     ~BitVecArray();
@@ -65,37 +122,64 @@ public:
     void init(BitCount t_NX, BitCount t_NY, BitCount t_NZ);
 
     /**
-     * Returns element i in data_
+     * Returns element i.
     */
-    Vec<uint64_t> const& operator[](unsigned i) const;
+    Vec<uint64_t> const operator[](unsigned i) const;
 
     /**
-     * Returns element i in data_
+     * Sets element i to v.
+     * Note: component values in v should be expressible by
+     * x, y & z - component precision set for this instance.
     */
-    Vec<uint64_t>& operator[](unsigned i);
+    void set(unsigned i, const Vec<uint64_t>& v);
+
+    /**
+     * Returns true if components are stored as uint32_t,
+     * false if they are stored as uint16_t.
+    */
+    bool isWide() const;
+
+    /**
+     * Returns the uint16_t component arrays.
+     * Only holds data if isWide() returns false.
+    */
+    const ComponentArrays<uint16_t>& getNarrow() const;
+
+    /**
+     * Returns the uint32_t component arrays.
+     * Only holds data if isWide() returns true.
+    */
+    const ComponentArrays<uint32_t>& getWide() const;
 
     /**
      * Fills list of BitVec elements from packed_data.
      * num_elements should hold the total number of BitVec elements
      * encoded by packed_data.
     */
-    void unpack(unsigned char* packed_data, size_t num_elmnts);
+    void unpack(const unsigned char* packed_data, size_t num_elmnts);
 
     /**
      * Returns a byte array of minimum size encoding all
      * BitVec elements maintained by this instance.
     */
-    unsigned char* pack();
+    unsigned char* pack() const;
+
+    /**
+     * Writes all BitVec elements maintained by this instance
+     * into packed_data, which has to provide getByteSize() bytes.
+     * Returns the number of bytes written.
+    */
+    size_t pack(unsigned char* packed_data) const;
 
     /**
-     * Appends aN element to data_.
+     * Appends an element.
      * Note: component values in v should be expressible by
      * x, y & z - component precision set for this instance.
     */
     void push_back(const Vec<uint64_t>& v);
 
     /**
-     * Appends an element to data_ value set from input parameters.
+     * Appends an element with value set from input parameters.
      * Note: component values in v should be expressible by
      * x, y & z - component precision set for this instance.
     */
@@ -103,7 +187,7 @@ public:
 
 
     /**
-     * Returns the current number of elements in data_.
+     * Returns the current number of elements.
     */
     unsigned size() const;
 
@@ -118,7 +202,9 @@ public:
     void clear();
 
 private:
-    std::vector<Vec<uint64_t>> data_;
+    ComponentArrays<uint16_t> narrow_;
+    ComponentArrays<uint32_t> wide_;
+    bool is_wide_;
     BitCount nx_;
     BitCount ny_;
     BitCount nz_;
@@ -0,0 +1,145 @@
+#ifndef LIBPCC_BYTE_STREAM_HPP
+#define LIBPCC_BYTE_STREAM_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Stores value as 4 byte little endian integer at out.
+*/
+inline void storeU32(unsigned char* out, uint32_t value)
+{
+    for(unsigned i = 0; i < 4; ++i)
+        out[i] = static_cast<unsigned char>(value >> (8*i));
+}
+
+/**
+ * Loads a 4 byte little endian integer from in.
+*/
+inline uint32_t loadU32(const unsigned char* in)
+{
+    uint32_t value = 0;
+    for(unsigned i = 0; i < 4; ++i)
+        value |= static_cast<uint32_t>(in[i]) << (8*i);
+    return value;
+}
+
+/**
+ * Writes fixed width little endian fields into a byte array,
+ * independent of size and byte order of the platform types.
+ * The caller guarantees sufficient space, no memory is allocated.
+*/
+class ByteWriter {
+public:
+    explicit ByteWriter(unsigned char* t_out, size_t t_offset = 0)
+        : out_(t_out)
+        , offset_(t_offset)
+    {}
+
+    void writeU8(uint8_t value)
+    {
+        out_[offset_++] = value;
+    }
+
+    void writeU32(uint32_t value)
+    {
+        storeU32(out_ + offset_, value);
+        offset_ += 4;
+    }
+
+    void writeU64(uint64_t value)
+    {
+        writeU32(static_cast<uint32_t>(value));
+        writeU32(static_cast<uint32_t>(value >> 32));
+    }
+
+    /**
+     * Writes the IEEE 754 bit pattern of value.
+    */
+    void writeF32(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeU32(bits);
+    }
+
+    size_t getOffset() const
+    {
+        return offset_;
+    }
+
+private:
+    unsigned char* out_;
+    size_t offset_;
+};
+
+/**
+ * Reads fields written by ByteWriter from a byte array of given size.
+ * Reading beyond size yields zero values and invalidates the reader,
+ * so a sequence of fields can be read before checking isValid() once.
+*/
+class ByteReader {
+public:
+    ByteReader(const unsigned char* t_in, size_t t_size, size_t t_offset = 0)
+        : in_(t_in)
+        , size_(t_size)
+        , offset_(t_offset)
+        , valid_(t_offset <= t_size)
+    {}
+
+    uint8_t readU8()
+    {
+        if(!require(1))
+            return 0;
+        return in_[offset_++];
+    }
+
+    uint32_t readU32()
+    {
+        if(!require(4))
+            return 0;
+        uint32_t value = loadU32(in_ + offset_);
+        offset_ += 4;
+        return value;
+    }
+
+    uint64_t readU64()
+    {
+        uint64_t low = readU32();
+        return low | (static_cast<uint64_t>(readU32()) << 32);
+    }
+
+    float readF32()
+    {
+        uint32_t bits = readU32();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    size_t getOffset() const
+    {
+        return offset_;
+    }
+
+    bool isValid() const
+    {
+        return valid_;
+    }
+
+private:
+    bool require(size_t num_bytes)
+    {
+        if(!valid_ || num_bytes > size_ - offset_)
+            valid_ = false;
+        return valid_;
+    }
+
+    const unsigned char* in_;
+    size_t size_;
+    size_t offset_;
+    bool valid_;
+};
+
+#endif //LIBPCC_BYTE_STREAM_HPP
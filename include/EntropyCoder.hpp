@@ -0,0 +1,132 @@
+#ifndef LIBPCC_ENTROPY_CODER_HPP
+#define LIBPCC_ENTROPY_CODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+/**
+ * Identifies the backend used for entropy coding a message.
+ * Values are encoded into messages, thus must not be changed.
+*/
+enum EntropyBackend : uint8_t {
+    ENTROPY_ZLIB = 0,  // zlib deflate, best ratio
+    ENTROPY_LZ = 1,    // in-tree byte oriented LZ77, low latency
+    ENTROPY_STORE = 2, // raw copy, no compression
+    ENTROPY_RANGE = 3  // cells are range coded instead of bit packed, see RangeCoder.hpp
+};
+
+/**
+ * Memory requested by an EntropyCoder, kept for subsequent calls.
+ * Calls of equal parameters request blocks of equal sizes,
+ * thus passing the same workspace again avoids allocations.
+ * A coder may also keep its stream open in the workspace,
+ * which saves setting up a stream for every call.
+ * A workspace must not be used by concurrent calls.
+*/
+class EntropyWorkspace {
+public:
+    /**
+     * Stream of an EntropyCoder kept open across calls, implemented by the coder.
+     * Its memory is acquired from the workspace holding it.
+    */
+    class CoderState {
+    public:
+        virtual ~CoderState() = default;
+
+        /**
+         * Releases the memory of the stream to given workspace.
+        */
+        virtual void close(EntropyWorkspace& workspace) = 0;
+    };
+
+    EntropyWorkspace();
+    ~EntropyWorkspace();
+
+    EntropyWorkspace(const EntropyWorkspace&) = delete;
+    EntropyWorkspace& operator=(const EntropyWorkspace&) = delete;
+    EntropyWorkspace(EntropyWorkspace&& rhs);
+    EntropyWorkspace& operator=(EntropyWorkspace&& rhs);
+
+    /**
+     * Returns a block of size bytes, reusing a released block of equal size if available.
+     * Returns nullptr if memory is exhausted.
+    */
+    void* acquire(size_t size);
+
+    /**
+     * Returns a block obtained from acquire to the workspace.
+    */
+    void release(void* ptr);
+
+    /**
+     * Returns the state stored by the last coder keeping its stream open, or nullptr.
+    */
+    CoderState* getCoderState() const;
+
+    /**
+     * Replaces the stored state, which is closed and deleted.
+     * The workspace takes ownership of state.
+    */
+    void setCoderState(CoderState* state);
+
+private:
+    // size of a block is stored in front of the memory handed out
+    static const size_t BLOCK_HEADER_SIZE = alignof(std::max_align_t);
+
+    // released blocks
+    std::vector<unsigned char*> blocks_;
+    CoderState* coder_state_;
+};
+
+/**
+ * Interface to a lossless block compressor used for entropy coding.
+ * Implementations are stateless, thus can be used from multiple threads concurrently.
+*/
+class EntropyCoder {
+public:
+    virtual ~EntropyCoder() = default;
+
+    virtual EntropyBackend getBackend() const = 0;
+
+    /**
+     * Returns the maximum compressed size of size bytes of input.
+    */
+    virtual size_t calcMaxCompressedSize(size_t size) const = 0;
+
+    /**
+     * Returns the maximum decompressed size of size bytes of compressed data,
+     * used to reject corrupted size fields before allocating.
+    */
+    virtual size_t calcMaxDecompressedSize(size_t size) const = 0;
+
+    /**
+     * Compresses size bytes of data into out, which can hold up to capacity bytes.
+     * level trades ratio for speed, its meaning depends on the backend.
+     * A negative level selects the default of the backend.
+     * Memory needed by the backend is taken from workspace, if given.
+     * Returns compressed size, or 0 if compression failed.
+    */
+    virtual size_t compress(const unsigned char* data, size_t size,
+                            unsigned char* out, size_t capacity, int level,
+                            EntropyWorkspace* workspace) const = 0;
+
+    /**
+     * Decompresses size bytes of data into out,
+     * which has to be filled with exactly out_size bytes.
+     * Memory needed by the backend is taken from workspace, if given.
+     * Returns success of operation.
+    */
+    virtual bool decompress(const unsigned char* data, size_t size,
+                            unsigned char* out, size_t out_size,
+                            EntropyWorkspace* workspace) const = 0;
+};
+
+/**
+ * Returns the EntropyCoder implementing given backend,
+ * or nullptr if backend is unknown or does not operate on bytes (ENTROPY_RANGE).
+*/
+const EntropyCoder* findEntropyCoder(EntropyBackend backend);
+
+#endif //LIBPCC_ENTROPY_CODER_HPP
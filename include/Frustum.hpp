@@ -0,0 +1,68 @@
+#ifndef LIBPCC_FRUSTUM_HPP
+#define LIBPCC_FRUSTUM_HPP
+
+#include "Vec.hpp"
+#include "BoundingBox.hpp"
+
+/**
+ * Data transfer object describing a convex volume bounded by 6 planes,
+ * such as the view frustum of a camera.
+ * A point p lies inside of plane i if dot(normals[i], p) + distances[i] >= 0.
+*/
+struct Frustum {
+    Frustum() = default;
+
+    /**
+     * Creates the volume of given BoundingBox.
+    */
+    explicit Frustum(const BoundingBox& bb)
+    {
+        normals[0] = Vec<float>( 1.0f, 0.0f, 0.0f); distances[0] = -bb.min.x;
+        normals[1] = Vec<float>(-1.0f, 0.0f, 0.0f); distances[1] =  bb.max.x;
+        normals[2] = Vec<float>(0.0f,  1.0f, 0.0f); distances[2] = -bb.min.y;
+        normals[3] = Vec<float>(0.0f, -1.0f, 0.0f); distances[3] =  bb.max.y;
+        normals[4] = Vec<float>(0.0f, 0.0f,  1.0f); distances[4] = -bb.min.z;
+        normals[5] = Vec<float>(0.0f, 0.0f, -1.0f); distances[5] =  bb.max.z;
+    }
+
+    /**
+     * Extracts the view frustum of given column major 4x4 (view-)projection matrix
+     * (OpenGL convention, clip space z in [-w,w]).
+     * Points are given in the space transformed by the matrix.
+    */
+    static Frustum fromMatrix(const float m[16])
+    {
+        Frustum f;
+        for(unsigned i = 0; i < 6; ++i) {
+            // rows 0-2 are added to (even i) or subtracted from (odd i) row 3
+            unsigned row = i / 2;
+            float sign = i % 2 == 0 ? 1.0f : -1.0f;
+            f.normals[i] = Vec<float>(m[3] + sign * m[row], m[7] + sign * m[4 + row], m[11] + sign * m[8 + row]);
+            f.distances[i] = m[15] + sign * m[12 + row];
+        }
+        return f;
+    }
+
+    /**
+     * Returns false if given BoundingBox lies completely outside of this volume.
+     * Conservative test, which may return true for boxes close to edges of the volume.
+    */
+    bool intersects(const BoundingBox& bb) const
+    {
+        for(unsigned i = 0; i < 6; ++i) {
+            const Vec<float>& n = normals[i];
+            // corner of bb furthest along the plane normal
+            float x = n.x >= 0.0f ? bb.max.x : bb.min.x;
+            float y = n.y >= 0.0f ? bb.max.y : bb.min.y;
+            float z = n.z >= 0.0f ? bb.max.z : bb.min.z;
+            if(n.x * x + n.y * y + n.z * z + distances[i] < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    Vec<float> normals[6];
+    float distances[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+};
+
+#endif //LIBPCC_FRUSTUM_HPP
@@ -0,0 +1,102 @@
+#ifndef LIBPCC_OCTREE_CODER_HPP
+#define LIBPCC_OCTREE_CODER_HPP
+
+#include "BitVecArray.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Identifies how positions of a GridCell are encoded.
+ * Stored in the message, thus values must not change.
+*/
+enum GeometryCoding : uint8_t {
+    GEOMETRY_PACKED = 0, // fixed width coordinates, see BitVecArray::pack
+    GEOMETRY_OCTREE = 1  // occupancy bytes of a per cell octree, level by level
+};
+
+/**
+ * Sort key of a point in level of detail order, see sortLodOrder.
+*/
+struct LodKey {
+    unsigned level;
+    uint64_t reversed_node;
+    unsigned octree_rank;
+
+    bool operator<(const LodKey& rhs) const
+    {
+        if(level != rhs.level)
+            return level < rhs.level;
+        if(reversed_node != rhs.reversed_node)
+            return reversed_node < rhs.reversed_node;
+        return octree_rank < rhs.octree_rank;
+    }
+};
+
+/**
+ * Buffers used by the octree functions.
+ * Keeping them across calls avoids allocations for cells of similar size,
+ * a scratch must not be used by concurrent calls.
+*/
+struct OctreeScratch {
+    std::vector<Vec<uint64_t>> pos;
+    std::vector<Vec<uint64_t>> clr;
+    std::vector<unsigned> octree_order;
+    std::vector<unsigned> order;
+    std::vector<LodKey> lod_keys;
+    // nodes of the current and next octree level
+    std::vector<size_t> node_ends;
+    std::vector<size_t> child_ends;
+    std::vector<Vec<uint64_t>> nodes;
+    std::vector<Vec<uint64_t>> children;
+    std::vector<uint64_t> leaf_counts;
+};
+
+/**
+ * Returns the number of octree levels needed to encode positions of given precision.
+ * Component bit b of every axis is resolved on level depth-1-b,
+ * axes of lower precision are not subdivided on the upper levels.
+*/
+unsigned calcOctreeDepth(BitCount nx, BitCount ny, BitCount nz);
+
+/**
+ * Reorders points and corresponding colors into octree order
+ * (Morton order with z as most significant axis).
+ * Points of equal position keep their relative order.
+*/
+void sortOctreeOrder(BitVecArray& points, BitVecArray& colors, OctreeScratch& scratch);
+
+/**
+ * Reorders points and corresponding colors into level of detail order.
+ * Points are grouped by the first octree level on which they are the first point of a node,
+ * coarse levels first. Within a level, nodes are ordered by their reversed child index sequence,
+ * thus consecutive points are spread across the cell.
+ * Every prefix of the reordered points is a spatially uniform subsample of the cell.
+*/
+void sortLodOrder(BitVecArray& points, BitVecArray& colors, OctreeScratch& scratch);
+
+/**
+ * Appends the octree encoding of given points to out.
+ * points have to be in octree order, see sortOctreeOrder.
+ * For every level, one occupancy byte per node of the level is written in node order.
+ * If leaves hold more than one point, the number of additional points
+ * per leaf follows as varint.
+*/
+void octreeEncodeCell(const BitVecArray& points, std::vector<unsigned char>& out, OctreeScratch& scratch);
+
+/**
+ * Decodes num_elmnts points from octree encoded data of up to size bytes into points,
+ * which has to be initialized to the precision used for encoding.
+ * points is only resized to num_elmnts once data is validated to hold exactly num_elmnts points,
+ * and is left empty on invalid input.
+ * Returns number of bytes read, or 0 if data is invalid.
+*/
+size_t octreeDecodeCell(const unsigned char* data, size_t size, size_t num_elmnts, BitVecArray& points,
+                        OctreeScratch& scratch);
+
+/**
+ * Returns an upper bound of the octree encoded size of num_elmnts points with given depth.
+*/
+size_t calcMaxOctreeSize(size_t num_elmnts, unsigned depth);
+
+#endif //LIBPCC_OCTREE_CODER_HPP
@@ -0,0 +1,63 @@
+#ifndef LIBPCC_OUTPUT_SINK_HPP
+#define LIBPCC_OUTPUT_SINK_HPP
+
+#include <cstdlib>
+
+/**
+ * Destination of an encoded message.
+ * The encoder reserves an upper bound of the message size,
+ * writes the message directly into the reserved region
+ * and commits the number of bytes actually written.
+*/
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    /**
+     * Returns a region of at least max_size writable bytes,
+     * or nullptr if such a region cannot be provided.
+    */
+    virtual unsigned char* reserve(size_t max_size) = 0;
+
+    /**
+     * Finishes a message of given size written into the reserved region.
+    */
+    virtual void commit(size_t size) = 0;
+};
+
+/**
+ * OutputSink writing into a fixed, caller provided buffer.
+*/
+class BufferSink : public OutputSink {
+public:
+    BufferSink(unsigned char* t_data, size_t t_capacity)
+        : data_(t_data)
+        , capacity_(t_capacity)
+        , size_(0)
+    {}
+
+    unsigned char* reserve(size_t max_size) override
+    {
+        return max_size <= capacity_ ? data_ : nullptr;
+    }
+
+    void commit(size_t size) override
+    {
+        size_ = size;
+    }
+
+    /**
+     * Returns number of bytes committed by last message.
+    */
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    unsigned char* data_;
+    size_t capacity_;
+    size_t size_;
+};
+
+#endif //LIBPCC_OUTPUT_SINK_HPP
@@ -0,0 +1,49 @@
+#ifndef LIBPCC_PACK_KERNELS_HPP
+#define LIBPCC_PACK_KERNELS_HPP
+
+#include "BitValue.hpp"
+
+#include <cstdint>
+
+/**
+ * Number of elements processed by one call of a PackKernel block.
+ * A block of 8 elements with NX+NY+NZ bits each always fills
+ * exactly NX+NY+NZ bytes, thus blocks can be packed independently
+ * and the remaining elements continue on a byte boundary.
+*/
+const size_t PACK_BLOCK_SIZE = 8;
+
+/**
+ * Packs num_blocks blocks of PACK_BLOCK_SIZE elements
+ * from component arrays x, y & z into out.
+ * Bit layout is equal to BitPacker.
+*/
+typedef void (*PackKernel)(const uint16_t* x, const uint16_t* y, const uint16_t* z,
+                           size_t num_blocks, unsigned char* out);
+
+/**
+ * Unpacks num_blocks blocks of PACK_BLOCK_SIZE elements
+ * from in into component arrays x, y & z.
+ * Bit layout is equal to BitUnpacker.
+*/
+typedef void (*UnpackKernel)(const unsigned char* in, size_t num_blocks,
+                             uint16_t* x, uint16_t* y, uint16_t* z);
+
+/**
+ * Pair of pack & unpack kernels compiled for one fixed x, y & z - component precision.
+ * Kernels operate on uint16_t components, thus precisions are limited to 16 bits.
+*/
+struct PackKernels {
+    PackKernel pack;
+    UnpackKernel unpack;
+};
+
+/**
+ * Returns the kernels specialized for given component precisions,
+ * or nullptr if no specialization exists for this triple.
+ * Kernels are portable scalar code, their speed comes from bit offsets
+ * being compile time constants rather than from SIMD instructions.
+*/
+const PackKernels* findPackKernels(BitCount nx, BitCount ny, BitCount nz);
+
+#endif //LIBPCC_PACK_KERNELS_HPP
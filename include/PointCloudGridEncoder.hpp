@@ -3,19 +3,49 @@
 
 #include "Encoder.hpp"
 #include "PointCloudGrid.hpp"
+#include "OutputSink.hpp"
+#include "EntropyCoder.hpp"
+#include "OctreeCoder.hpp"
+#include "Frustum.hpp"
+#include "RadixSort.hpp"
+#include "ThreadPool.hpp"
+#include "SerialExecutor.hpp"
 
 #include <zmq.hpp>
 
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <iostream>
-#include <map>
+
+/**
+ * Identifies the layout of a message, stored in its GlobalHeader.
+ * Messages start with a magic number followed by the version,
+ * the decoder reads all versions up to FORMAT_VERSION_CURRENT.
+ * All multi byte fields are little endian, integers of fixed width.
+ * FORMAT_VERSION_LEGACY is the unversioned layout of the original implementation
+ * on 64 bit little endian platforms. It is only decoded, its GlobalHeader is the
+ * entropy coding flag followed by 2 x 8 byte sizes, entropy coded grids are a single
+ * zlib stream, blacklisted cells are listed by index and cell headers are unpacked.
+*/
+enum FormatVersion : uint8_t {
+    FORMAT_VERSION_LEGACY = 0,           // unversioned messages without magic number, decoded only
+    FORMAT_VERSION_UNPACKED_HEADERS = 1, // CellHeader as unsigned element count followed by 6 BitCounts
+    FORMAT_VERSION_PACKED_HEADERS = 2,   // CellHeader as varint element count followed by 5 bit precisions
+    FORMAT_VERSION_CURRENT = FORMAT_VERSION_PACKED_HEADERS
+};
 
 /**
  * Provides interface to point cloud compression
  * based on grid segmentation and adaptive quantization
  * of grid cells.
+ * State of encoding and decoding is held by a PointCloudGridEncoder::Context.
+ * Overloads taking a Context are const and may be called concurrently with distinct contexts,
+ * the others use a Context owned by this instance and must not overlap.
 */
 class PointCloudGridEncoder : public Encoder {
 public:
@@ -29,9 +59,18 @@ public:
         EncodingSettings()
             : grid_precision()
             , verbose(false)
-            , num_threads(24)
+            , num_threads(0)
             , irrelevance_coding(true)
             , entropy_coding(true)
+            , entropy_backend(ENTROPY_ZLIB)
+            , entropy_level(-1)
+            , geometry_coding(GEOMETRY_PACKED)
+            , progressive_ordering(false)
+            , keyframe_interval(0)
+            , skip_tolerance(0)
+            , cell_caching(false)
+            , cell_offset_table(false)
+            , format_version(FORMAT_VERSION_CURRENT)
             , appendix_size(0)
         {}
 
@@ -62,9 +101,35 @@ public:
 
         GridPrecisionDescriptor grid_precision;
         bool verbose;
+        // maximum number of threads per parallel loop, 0 for all threads of the pool
         int num_threads;
         bool irrelevance_coding;
         bool entropy_coding;
+        // backend used if entropy_coding is enabled
+        EntropyBackend entropy_backend;
+        // backend specific ratio/speed tradeoff, e.g. zlib level [0,9], negative for default
+        int entropy_level;
+        // encoding of cell positions, ignored by ENTROPY_RANGE, which codes positions itself
+        GeometryCoding geometry_coding;
+        // stores points of every cell in level of detail order, such that decoding
+        // with a point budget only reads a prefix of each cell. Ignored by GEOMETRY_OCTREE.
+        bool progressive_ordering;
+        // number of frames from one keyframe to the next (including the keyframe),
+        // frames in between are delta frames skipping cells unchanged w.r.t. the previous frame.
+        // 0 or 1 encodes every frame as self-contained keyframe.
+        unsigned keyframe_interval;
+        // largest difference of quantized components for which a cell is still
+        // considered unchanged in delta frames, 0 only skips identical cells
+        unsigned skip_tolerance;
+        // keeps encoded data of every cell along with a copy & hash of its content,
+        // cells with unchanged content reuse their encoded data instead of being packed/range coded again
+        bool cell_caching;
+        // stores the message offset of every cell header behind the skip list,
+        // such that the decoder locates cells without reading preceding cell headers
+        bool cell_offset_table;
+        // message layout written by the encoder,
+        // older versions can be selected for receivers not supporting the current one
+        FormatVersion format_version;
         unsigned long appendix_size;
     };
 
@@ -91,6 +156,42 @@ public:
         size_t black_list_size;
     };
 
+    /**
+     * Data transfer object holding the result of decodeAsync.
+     */
+    struct DecodeResult {
+        DecodeResult()
+            : success(false)
+            , point_cloud()
+            , decode_log()
+        {}
+
+        bool success;
+        std::vector<UncompressedVoxel> point_cloud;
+        DecodeLog decode_log;
+    };
+
+    /**
+     * Data transfer object describing a point cloud encoded by encodeBatch.
+     * grid_precision replaces settings.grid_precision for this cloud, unless nullptr.
+     * num_points is handled as described for PointCloudGridEncoder::encode.
+     */
+    struct BatchCloud {
+        BatchCloud(const std::vector<UncompressedVoxel>* pc = nullptr,
+                   const GridPrecisionDescriptor* precision = nullptr, int n = -1)
+            : point_cloud(pc)
+            , grid_precision(precision)
+            , num_points(n)
+        {}
+
+        const std::vector<UncompressedVoxel>* point_cloud;
+        const GridPrecisionDescriptor* grid_precision;
+        int num_points;
+    };
+
+    typedef std::function<void(zmq::message_t&& msg)> EncodeCallback;
+    typedef std::function<void(DecodeResult&& result)> DecodeCallback;
+
     EncodingSettings settings;
     EncodeLog encode_log;
     DecodeLog decode_log;
@@ -99,8 +200,43 @@ private:
     template<typename C>
     using GridVec = std::vector<std::vector<Vec<C>>>;
 
-    typedef std::map<Vec<uint64_t>, std::pair<Vec<uint64_t>, int>> PropertyMap;
-    typedef std::pair<Vec<uint64_t>, std::pair<Vec<uint64_t>, int>> PropertyPair;
+    /**
+     * Data transfer object holding a quantized voxel while building a PointCloudGrid.
+     * The quantized position is stored as a 96 bit key [z | y | x],
+     * so that ordering by key equals ordering by z, y & x - component.
+     * point_idx references the voxel in the uncompressed point cloud.
+    */
+    struct QuantizedVoxel {
+        uint64_t pos_key_hi;
+        uint64_t pos_key_lo;
+        uint32_t clr[3];
+        unsigned point_idx;
+
+        void setPos(const Vec<uint64_t>& pos)
+        {
+            pos_key_hi = pos.z;
+            pos_key_lo = (pos.y << 32) | pos.x;
+        }
+
+        Vec<uint64_t> const getPos() const
+        {
+            return Vec<uint64_t>(pos_key_lo & 0xFFFFFFFF, pos_key_lo >> 32, pos_key_hi);
+        }
+
+        bool samePos(const QuantizedVoxel& rhs) const
+        {
+            return pos_key_hi == rhs.pos_key_hi && pos_key_lo == rhs.pos_key_lo;
+        }
+
+        bool operator<(const QuantizedVoxel& rhs) const
+        {
+            if(pos_key_hi != rhs.pos_key_hi)
+                return pos_key_hi < rhs.pos_key_hi;
+            if(pos_key_lo != rhs.pos_key_lo)
+                return pos_key_lo < rhs.pos_key_lo;
+            return point_idx < rhs.point_idx;
+        }
+    };
 
     /**
      * Data transfer object for encoding first chunk in a message.
@@ -110,24 +246,46 @@ private:
     */
     struct GlobalHeader {
         GlobalHeader()
-            : entropy_coding(false)
+            : format_version(FORMAT_VERSION_CURRENT)
+            , entropy_coding(false)
+            , entropy_backend(ENTROPY_ZLIB)
+            , geometry_coding(GEOMETRY_PACKED)
+            , progressive(false)
             , uncompressed_size(0)
             , appendix_size(0)
         {}
 
+        FormatVersion format_version;
         bool entropy_coding;
+        EntropyBackend entropy_backend;
+        GeometryCoding geometry_coding;
+        // points of every cell are stored in level of detail order
+        bool progressive;
         unsigned long uncompressed_size;
         unsigned long appendix_size;
 
-        static size_t getByteSize()
+        /**
+         * Returns the encoded size for messages of given version:
+         * 4 byte magic number, version, 4 byte feature flags,
+         * backend, geometry coding, 2 x 8 byte sizes.
+         * FORMAT_VERSION_LEGACY: entropy coding flag, 2 x 8 byte sizes.
+        */
+        static size_t getByteSize(FormatVersion version = FORMAT_VERSION_CURRENT)
         {
-            return sizeof(bool) + 2*sizeof(unsigned long);
+            if(version == FORMAT_VERSION_LEGACY)
+                return sizeof(uint8_t) + 2*sizeof(uint64_t);
+            return sizeof(uint32_t) + sizeof(FormatVersion) + sizeof(uint32_t) + sizeof(EntropyBackend) +
+                   sizeof(GeometryCoding) + 2*sizeof(uint64_t);
         }
 
         const std::string toString()
         {
             std::stringstream ss;
-            ss << "GlobalHeader(entropy_coding = " << entropy_coding << ", ";
+            ss << "GlobalHeader(format_version = " << (int) format_version << ", ";
+            ss << "entropy_coding = " << entropy_coding << ", ";
+            ss << "entropy_backend = " << (int) entropy_backend << ", ";
+            ss << "geometry_coding = " << (int) geometry_coding << ", ";
+            ss << "progressive = " << progressive << ", ";
             ss << "uncompressed_size = " << uncompressed_size << ", ";
             ss << "appendix_size = " << appendix_size << ")";
             return ss.str();
@@ -142,10 +300,16 @@ private:
         Vec8 dimensions;
         BoundingBox bounding_box;
         unsigned num_blacklist;
+        // delta frames only contain cells changed w.r.t. frame frame_idx-1
+        bool delta_frame;
+        unsigned frame_idx;
+        unsigned num_skipped;
+        // an offset table of all cells follows the skip list
+        bool offset_table;
 
         static size_t getByteSize()
         {
-            return 3*sizeof(uint8_t) + 6*sizeof(float) + sizeof(unsigned);
+            return 3*sizeof(uint8_t) + 6*sizeof(float) + 3*sizeof(uint32_t) + 2*sizeof(uint8_t);
         }
 
         const std::string toString() const
@@ -154,17 +318,22 @@ private:
             ss << "GridHeader(dim=[" << (int) dimensions.x << "," << (int) dimensions.y << "," << (int) dimensions.z << "], ";
             ss << "bb={[" << bounding_box.min.x << "," << bounding_box.min.y << "," << bounding_box.min.z << "];";
             ss << "[" << bounding_box.max.x << "," << bounding_box.max.y << "," << bounding_box.max.z << "]}, ";
-            ss << "num_bl=" << num_blacklist << ")";
+            ss << "num_bl=" << num_blacklist << ", ";
+            ss << "delta=" << delta_frame << ", ";
+            ss << "frame=" << frame_idx << ", ";
+            ss << "num_skip=" << num_skipped << ", ";
+            ss << "offset_table=" << offset_table << ")";
             return ss.str();
         }
     };
 
     /**
      * Data transfer object for encoding meta info about a GridCell in a PointCloudGrid.
+     * Packed (FORMAT_VERSION_PACKED_HEADERS) as varint of (num_elements << 1 | same precision flag),
+     * followed by the 6 precisions minus 1 in 5 bits each, if they differ from the previous header.
     */
     struct CellHeader {
         unsigned cell_idx; // not added to message (debug use)
-        // TODO: pack
         BitCount point_encoding_x;
         BitCount point_encoding_y;
         BitCount point_encoding_z;
@@ -172,12 +341,26 @@ private:
         BitCount color_encoding_y;
         BitCount color_encoding_z;
         unsigned num_elements;
+        unsigned num_decoded; // not added to message (number of elements decoded)
 
+        /**
+         * Returns size of an unpacked header, which is an upper bound of the packed size.
+        */
         static size_t getByteSize()
         {
             return 1*sizeof(unsigned)+6*sizeof(BitCount);
         }
 
+        bool samePrecision(const CellHeader& rhs) const
+        {
+            return point_encoding_x == rhs.point_encoding_x &&
+                   point_encoding_y == rhs.point_encoding_y &&
+                   point_encoding_z == rhs.point_encoding_z &&
+                   color_encoding_x == rhs.color_encoding_x &&
+                   color_encoding_y == rhs.color_encoding_y &&
+                   color_encoding_z == rhs.color_encoding_z;
+        }
+
         const std::string toString() const
         {
             std::stringstream ss;
@@ -193,7 +376,114 @@ private:
         }
     };
 
+    /**
+     * Intermediate data of encoding & decoding a frame, kept across frames.
+     * Containers are cleared or resized but never shrunk,
+     * thus frames of similar shape reuse memory instead of allocating it.
+    */
+    struct FrameArena {
+        // grid building
+        std::vector<QuantizedVoxel> quantized;
+        std::vector<QuantizedVoxel> bucketed;
+        std::vector<unsigned> point_cell_idx;
+        std::vector<size_t> cell_begin;
+        std::vector<size_t> cell_histograms;
+        std::vector<KeyValuePair> sorted;
+        RadixSortScratch radix_sort;
+        // grid message, per cell flags indexed by cell_idx, others in message order
+        std::vector<unsigned char> black_cells;
+        std::vector<unsigned char> skipped;
+        std::vector<unsigned> skip_list;
+        std::vector<unsigned> white_cells;
+        std::vector<unsigned char> selected;
+        std::vector<CellHeader> cell_headers;
+        std::vector<size_t> cell_offsets;
+        std::vector<unsigned> table_offsets;
+        // entropy coding chunks
+        std::vector<size_t> chunk_bounds;
+        std::vector<size_t> chunk_in_offsets;
+        std::vector<size_t> chunk_out_offsets;
+        std::vector<size_t> chunk_sizes;
+        std::vector<EntropyWorkspace> entropy_workspaces;
+        // octree & level of detail coding, one per block of cells
+        std::vector<OctreeScratch> octree_scratches;
+        // point cloud extraction
+        std::vector<unsigned> point_offsets;
+    };
+
 public:
+    /**
+     * State of encoding or decoding a stream of frames: grid of the last frame,
+     * message headers, intermediate buffers, temporal coding state and logs.
+     * A Context is used by one call at a time and reuses its memory for later frames,
+     * thus contexts can be pooled, e.g. by a server decoding many streams with shared settings.
+     * Delta frames refer to the previous frame of the same Context,
+     * while keyframes can be encoded and decoded with any Context.
+    */
+    class Context {
+    public:
+        Context();
+        ~Context();
+
+        Context(const Context&) = delete;
+        Context& operator=(const Context&) = delete;
+
+        /**
+         * Returns the grid of the last frame encoded or decoded with this Context.
+        */
+        const PointCloudGrid* getPointCloudGrid() const;
+
+        /**
+         * Forces the next frame encoded with this Context to be a keyframe,
+         * see PointCloudGridEncoder::requestKeyframe.
+        */
+        void requestKeyframe();
+
+        EncodeLog encode_log;
+        DecodeLog decode_log;
+
+    private:
+        friend class PointCloudGridEncoder;
+        friend class PointCloudStreamEncoder;
+
+        PointCloudGrid* pc_grid_;
+        GridHeader header_;
+        GlobalHeader global_header_;
+        // uncompressed grid message, reused for entropy coding & decoding
+        std::vector<unsigned char> grid_buffer_;
+        // range or octree coded data per cell, reused for coding
+        std::vector<std::vector<unsigned char>> coded_cells_;
+        // intermediate data of the current frame
+        FrameArena arena_;
+
+        // temporal coding state of encoder:
+        // grid as reconstructed by the decoder after the last encoded frame
+        PointCloudGrid* ref_grid_;
+        bool ref_grid_valid_;
+        unsigned next_frame_idx_;
+        unsigned frames_since_keyframe_;
+        // per cell flag of the current frame, set for cells skipped in a delta frame
+        std::vector<unsigned char> cell_skipped_;
+
+        // cell cache of encoder:
+        // content hash of the cell data held by packed_cells_ or coded_cells_
+        std::vector<uint64_t> cell_hashes_;
+        // cell content of the cached data, compared if hashes are equal
+        PointCloudGrid* cache_grid_;
+        // packed data per cell, reused for cells with unchanged hash
+        std::vector<std::vector<unsigned char>> packed_cells_;
+        // per cell flag of the current frame, set for cells reusing cached data
+        std::vector<unsigned char> cell_cached_;
+        // encoding of cached data
+        bool cache_range_coded_;
+        bool cache_octree_coded_;
+
+        // temporal coding state of decoder:
+        // pc_grid_ holds the frame decoded_frame_idx_, if decoded_frame_valid_ is set
+        bool decoded_frame_valid_;
+        unsigned decoded_frame_idx_;
+    };
+
     explicit PointCloudGridEncoder(const EncodingSettings& s = EncodingSettings());
     ~PointCloudGridEncoder();
 
@@ -205,10 +495,156 @@ public:
     */
     zmq::message_t encode(const std::vector<UncompressedVoxel>& point_cloud, int num_points=-1);
 
+    /**
+     * Compresses given UncompressedPointCloud directly into memory provided by sink.
+     * The region reserved from sink is an upper bound of the message size,
+     * the actual message size is committed to sink and returned.
+     * Returns 0 if sink could not provide the reserved region or entropy coding failed,
+     * the next frame is then encoded as keyframe.
+     * num_points is handled as described for PointCloudGridEncoder::encode.
+    */
+    size_t encode(const std::vector<UncompressedVoxel>& point_cloud, OutputSink& sink, int num_points=-1);
+
+    /**
+     * Encodes given point_cloud like encode, keeping all state in given ctx
+     * instead of this instance. Calls using distinct contexts may run concurrently.
+     * Statistics are stored in Context::encode_log.
+    */
+    zmq::message_t encode(const std::vector<UncompressedVoxel>& point_cloud, Context& ctx, int num_points=-1) const;
+    size_t encode(const std::vector<UncompressedVoxel>& point_cloud, OutputSink& sink, Context& ctx,
+                  int num_points=-1) const;
+
+    /**
+     * Encodes all clouds of a batch, e.g. the objects of a scene, into messages,
+     * which is resized to the number of clouds. messages[i] equals the message
+     * encode creates for clouds[i] using its grid precision.
+     * Clouds are encoded in parallel, each of them using parallel loops itself.
+     * clouds[i] is encoded on a Context owned by this instance, which is kept for
+     * clouds[i] of the next batch. Thus with settings.keyframe_interval > 1,
+     * clouds at the same index of consecutive batches form a stream of delta frames.
+     * Returns false if a cloud could not be encoded, its message is left empty.
+    */
+    bool encodeBatch(const std::vector<BatchCloud>& clouds, std::vector<zmq::message_t>& messages);
+
+    /**
+     * Encodes all clouds of a batch like encodeBatch,
+     * clouds[i] on contexts[i], which have to be distinct.
+    */
+    bool encodeBatch(const std::vector<BatchCloud>& clouds, std::vector<zmq::message_t>& messages,
+                     const std::vector<Context*>& contexts) const;
+
+    /**
+     * Compresses given UncompressedPointCloud into given buffer of capacity bytes.
+     * Returns size of the message written, or 0 if capacity does not suffice.
+     * A capacity of calcMaxMessageSize(num_points) is always sufficient.
+    */
+    size_t encodeInto(const std::vector<UncompressedVoxel>& point_cloud, unsigned char* out,
+                      size_t capacity, int num_points=-1);
+
+    /**
+     * Returns the maximum size of a message encoding num_points points
+     * with current PointCloudGridEncoder::settings.
+     * Can be used to allocate output buffers for encodeInto once.
+    */
+    size_t calcMaxMessageSize(size_t num_points) const;
+
+    /**
+     * Forces the next encoded frame to be a keyframe,
+     * e.g. if a receiver joins the stream or lost a message.
+     * Only relevant if settings.keyframe_interval > 1.
+    */
+    void requestKeyframe();
+
     /**
      * Decodes given message into point_cloud. Returns success.
+     * Delta frames can only be decoded directly after their predecessor,
+     * decoding fails for delta frames until the next keyframe otherwise.
+     * If max_points > 0, at most max_points points are decoded,
+     * distributed over all cells in proportion to their size.
+     * Messages encoded with settings.progressive_ordering then only
+     * decode a prefix of every cell, others are subsampled after decoding.
+     * Delta frames can not be decoded after a frame decoded with a point budget.
+    */
+    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, size_t max_points = 0);
+
+    /**
+     * Decodes message of given size stored at data into point_cloud.
+     * Cell data is unpacked directly from data without intermediate copies,
+     * only entropy coded messages are inflated into an internal buffer.
+     * max_points is handled as described for PointCloudGridEncoder::decode.
+     * Returns success.
+    */
+    bool decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                size_t max_points = 0);
+
+    /**
+     * Decodes the part of given message within roi into point_cloud.
+     * Cells not intersecting roi are neither unpacked nor extracted,
+     * all points of intersecting cells are extracted.
+     * max_points is handled as described for PointCloudGridEncoder::decode.
+     * Delta frames can not be decoded after a frame decoded partially.
+     * Returns success.
     */
-    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud);
+    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, const BoundingBox& roi,
+                size_t max_points = 0);
+    bool decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                const BoundingBox& roi, size_t max_points = 0);
+
+    /**
+     * Decodes the part of given message within view frustum into point_cloud,
+     * see decode using a BoundingBox as roi.
+    */
+    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, const Frustum& frustum,
+                size_t max_points = 0);
+    bool decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                const Frustum& frustum, size_t max_points = 0);
+
+    /**
+     * Decodes given message like decode, keeping all state in given ctx
+     * instead of this instance. Calls using distinct contexts may run concurrently.
+     * Delta frames are decoded onto the previous frame decoded with ctx.
+     * Statistics are stored in Context::decode_log.
+    */
+    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, Context& ctx,
+                size_t max_points = 0) const;
+    bool decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud, Context& ctx,
+                size_t max_points = 0) const;
+    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, const BoundingBox& roi,
+                Context& ctx, size_t max_points = 0) const;
+    bool decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                const BoundingBox& roi, Context& ctx, size_t max_points = 0) const;
+    bool decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, Context& ctx,
+                const Frustum& frustum, size_t max_points = 0) const;
+    bool decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud, Context& ctx,
+                const Frustum& frustum, size_t max_points = 0) const;
+
+    /**
+     * Encodes given point_cloud like encode on a thread owned by this instance.
+     * The instance takes ownership of point_cloud, the message is moved
+     * into the returned future or the given callback, which is called on that thread.
+     * Asynchronous calls are processed one after another in order of submission,
+     * so delta frames refer to the frame submitted before. Until all of them
+     * are finished, no other members may be called and settings must not be changed.
+     * An exception thrown by encoding is stored in the future, the callback
+     * is given an empty message instead, like for any failed encoding.
+     * The next frame is encoded as keyframe.
+    */
+    std::future<zmq::message_t> encodeAsync(std::vector<UncompressedVoxel> point_cloud, int num_points=-1);
+    void encodeAsync(std::vector<UncompressedVoxel> point_cloud, EncodeCallback callback, int num_points=-1);
+
+    /**
+     * Decodes given message like decode on a second thread owned by this instance,
+     * so it overlaps with encodeAsync. Decoding state is kept apart from
+     * encoding state and from decode, delta frames are decoded onto the frame
+     * of the previous decodeAsync call. Statistics are stored in DecodeResult::decode_log,
+     * getPointCloudGrid does not reflect asynchronously decoded frames.
+     * The instance takes ownership of msg, the decoded point cloud is moved
+     * into the returned future or the given callback, see encodeAsync.
+     * An exception thrown by decoding is stored in the future,
+     * the callback is given a DecodeResult without success instead.
+    */
+    std::future<DecodeResult> decodeAsync(zmq::message_t msg, size_t max_points = 0);
+    void decodeAsync(zmq::message_t msg, DecodeCallback callback, size_t max_points = 0);
 
     /**
      * Returns a reference to the PointCloudGrid maintained by this instance.
@@ -219,6 +655,14 @@ public:
     */
     const PointCloudGrid* getPointCloudGrid() const;
 
+    /**
+     * Sets the pool running parallel loops of encoding and decoding,
+     * e.g. to confine several encoders to a subset of cores.
+     * The pool has to outlive this instance or be replaced before.
+     * nullptr selects ThreadPool::getDefault(), which is used initially.
+    */
+    void setThreadPool(ThreadPool* pool);
+
     /**
      * Inserts optional contents into given zmq::message_t.
      * Can be used to transmit arbitrary contents along with message.
@@ -229,7 +673,7 @@ public:
      * with size being the amount of bytes copied from data.
      * Returns success of operation.
     */
-    bool writeToAppendix(zmq::message_t& msg, unsigned char* data, unsigned long size);
+    bool writeToAppendix(zmq::message_t& msg, unsigned char* data, unsigned long size) const;
 
 /**
      * Inserts optional contents into given zmq::message_t.
@@ -239,168 +683,416 @@ public:
      * appendix_size in PointCloudGridEncoder::settings.appendix_size.
      * Returns success of operation.
     */
-    bool writeToAppendix(zmq::message_t& msg, const std::string& text);
+    bool writeToAppendix(zmq::message_t& msg, const std::string& text) const;
 
     /**
      * Retrieves appendix contents from given zmq:message_t into data.
      * msg has to be of format produced by encoder.
      * Returns size of appendix.
     */
-    unsigned long readFromAppendix(zmq::message_t& msg, unsigned char*& data);
+    unsigned long readFromAppendix(zmq::message_t& msg, unsigned char*& data) const;
 
     /**
      * Retrieves appendix contents from given zmq:message_t into text.
      * msg has to be of format produced by encoder.
     */
-    void readFromAppendix(zmq::message_t& msg, std::string& text);
+    void readFromAppendix(zmq::message_t& msg, std::string& text) const;
 
 private:
+    // runs the stages of encoding with separate contexts
+    friend class PointCloudStreamEncoder;
+
+    /**
+     * Compresses size bytes of given data using given coder
+     * into out, which can hold up to calcMaxEntropySize(coder, size) bytes.
+     * data is split at a subset of split_offsets (e.g. cell boundaries)
+     * into chunks, which are compressed independently in parallel.
+     * Compressed chunks are preceded by a chunk table.
+     * Returns compressed size, or 0 if a chunk could not be compressed.
+    */
+    size_t entropyCompression(Context& ctx, const EntropyCoder* coder, const unsigned char* data, size_t size,
+                              const std::vector<size_t>& split_offsets, unsigned char* out) const;
+
     /**
-     * Prepends GlobalHeader and adds space for appendix.
+     * Decompresses size bytes of given data produced by entropyCompression
+     * using given coder into out, which is resized to out_size bytes.
+     * out is only resized once the chunk table is verified to add up to out_size
+     * and no chunk exceeds the maximum expansion of the coder.
+     * Chunks are decompressed in parallel.
+     * FORMAT_VERSION_LEGACY data is a single chunk without chunk table.
+     * Returns success of operation.
     */
-    zmq::message_t finalizeMessage(zmq::message_t msg);
+    bool entropyDecompression(Context& ctx, const EntropyCoder* coder, const unsigned char* data, size_t size,
+                              std::vector<unsigned char>& out, size_t out_size) const;
 
     /**
-     * Compresses and returns given msg using zlib deflate.
+     * Returns the maximum size of entropyCompression output
+     * for size bytes of input using given coder.
     */
-    zmq::message_t entropyCompression(zmq::message_t msg);
+    size_t calcMaxEntropySize(const EntropyCoder* coder, size_t size) const;
 
     /**
-     * Decompressed and returns given msg using zlib inflate.
+     * Encodes given point_cloud like encode into sink,
+     * using given precision instead of settings.grid_precision.
     */
-    zmq::message_t entropyDecompression(zmq::message_t& msg, size_t offset);
+    size_t encodeCloud(Context& ctx, const std::vector<UncompressedVoxel>& point_cloud, int num_points,
+                       const GridPrecisionDescriptor& precision, OutputSink& sink) const;
 
     /**
-     * Fills PointCloudGridEncoder::pc_grid_ from given point_cloud
-     * and PointCloudGridEncoder::settings.
+     * First stage of encoding.
+     * Fills Context::pc_grid_ from given point_cloud
+     * quantized with given precision.
      * num_points specifies the number of points used in compression
      * from point_cloud.first() to point_cloud.first() + num_points.
     */
-    void buildPointCloudGrid(const std::vector<UncompressedVoxel>& point_cloud, int num_points);
+    void buildPointCloudGrid(Context& ctx, const std::vector<UncompressedVoxel>& point_cloud, int num_points,
+                             const GridPrecisionDescriptor& precision) const;
+
+    /**
+     * Second stage of encoding, prior to encodePointCloudGrid.
+     * Sets up Context::global_header_ from settings, orders the points of all cells
+     * and selects skipped, cached and precoded cells of Context::pc_grid_.
+     * coder is set to the byte level entropy coder of the message, or nullptr if none is used.
+     * Returns false for invalid settings.
+    */
+    bool prepareGridMessage(Context& ctx, const EntropyCoder** coder) const;
 
     /**
-     * Extracts a uncompressed point cloud from PointCloudGridEncoder::pc_grid_.
+     * Returns the maximum size of a message holding a grid message of grid_size bytes,
+     * compressed by coder unless nullptr.
+    */
+    size_t calcMessageCapacity(const EntropyCoder* coder, size_t grid_size) const;
+
+    /**
+     * Writes Context::global_header_ for a grid message of grid_size bytes
+     * in front of the payload_size bytes of payload at out + GlobalHeader::getByteSize(),
+     * followed by the appendix. Returns message size.
+    */
+    size_t finishMessage(Context& ctx, unsigned char* out, size_t grid_size, size_t payload_size) const;
+
+    /**
+     * Third stage of encoding, if stages run on separate instances.
+     * Creates a message with given header from the grid message of grid_size bytes at grid,
+     * entropy coded by coder unless nullptr. split_offsets are those left by encodePointCloudGrid.
+     * Returns an empty message if memory could not be allocated or compression failed.
+    */
+    zmq::message_t encodeGridMessage(Context& ctx, const GlobalHeader& header, const EntropyCoder* coder,
+                                     const unsigned char* grid, size_t grid_size,
+                                     const std::vector<size_t>& split_offsets) const;
+
+    /**
+     * Extracts a uncompressed point cloud from Context::pc_grid_.
      * Results are stored in given point_cloud.
      * Returns success of operation.
     */
-    bool extractPointCloudFromGrid(std::vector<UncompressedVoxel>* point_cloud);
+    bool extractPointCloudFromGrid(Context& ctx, std::vector<UncompressedVoxel>* point_cloud) const;
 
     /**
-     * Creates a zmq message from current PointCloudGridEncoder::pc_grid_.
+     * Encodes current Context::pc_grid_ into out,
+     * which has to hold at least calcGridMessageSize(ctx) bytes.
+     * The message offset of every encoded cell followed by the end of the message
+     * remains in FrameArena::cell_offsets.
+     * Returns number of bytes written.
     */
-    zmq::message_t encodePointCloudGrid();
+    size_t encodePointCloudGrid(Context& ctx, unsigned char* out) const;
 
     /**
      * Helper function for PointCloudGridEncoder::decode,
-     * to extract a point cloud grid from given zmq message
-     * into PointCloudGridEncoder::pc_grid_.
+     * to extract a point cloud grid from given message of size bytes
+     * into Context::pc_grid_.
+     * If region is given, only cells intersecting region are decoded.
      * Returns success of operation.
     */
-    bool decodePointCloudGrid(zmq::message_t& msg);
+    bool decodePointCloudGrid(Context& ctx, const unsigned char* msg, size_t size, size_t max_points = 0,
+                              const Frustum* region = nullptr) const;
 
     /**
-     * Helper function for PointCloudGridEncoder::encodePointCloudGrid.
-     * Encodes the PointCloudGridEncoder::GlobalHeader for given msg
-     * at msg.data() + offset.
+     * Helper function for PointCloudGridEncoder::encode.
+     * Encodes given PointCloudGridEncoder::GlobalHeader
+     * at msg + offset.
      * Returns offset after extending msg.
     */
-    size_t encodeGlobalHeader(zmq::message_t& msg, size_t offset = 0);
+    size_t encodeGlobalHeader(const GlobalHeader& header, unsigned char* msg, size_t offset = 0) const;
 
     /**
      * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
-     * Decodes the PointCloudGridEncoder::GlobalHeader for given msg
-     * at msg.data() + offset.
-     * Returns offset after decoding part of msg.
+     * Decodes a PointCloudGridEncoder::GlobalHeader into given header
+     * from the beginning of msg of given size.
+     * Returns offset after decoding part of msg,
+     * or 0 if the header is truncated, of unknown version
+     * or uses unknown features.
     */
-    size_t decodeGlobalHeader(zmq::message_t& msg, size_t offset = 0);
+    size_t decodeGlobalHeader(const unsigned char* msg, size_t size, GlobalHeader& header) const;
 
     /**
      * Helper function for PointCloudGridEncoder::encodePointCloudGrid.
-     * Encodes the PointCloudGridEncoder::GridHeader for given msg
-     * at msg.data() + offset.
+     * Encodes the PointCloudGridEncoder::GridHeader
+     * at msg + offset.
      * Returns offset after extending msg.
     */
-    size_t encodeGridHeader(zmq::message_t& msg, size_t offset = 0);
+    size_t encodeGridHeader(Context& ctx, unsigned char* msg, size_t offset = 0) const;
 
     /**
      * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
-     * Decodes the PointCloudGridEncoder::GridHeader for given msg
-     * at msg.data() + offset.
-     * Returns offset after decoding part of msg.
+     * Decodes the PointCloudGridEncoder::GridHeader
+     * at msg + offset, where msg holds size bytes.
+     * Returns offset after decoding part of msg, or 0 if msg is too short.
     */
-    size_t decodeGridHeader(zmq::message_t& msg, size_t offset = 0);
+    size_t decodeGridHeader(Context& ctx, const unsigned char* msg, size_t size, size_t offset = 0) const;
 
     /**
      * Helper function for PointCloudGridEncoder::encodePointCloudGrid.
-     * Encodes the point cloud grid blacklist for given msg,
-     * which contains the index of all cells not conatining any data.
-     * Encoding is started at msg.data() + offset.
+     * Encodes the point cloud grid blacklist,
+     * which flags all cells not containing any data (black_cells[cell_idx] != 0),
+     * as bitmap or as run lengths, whichever is smaller.
+     * Encoding is started at msg + offset.
      * Returns offset after extending msg.
     */
-    size_t encodeBlackList(zmq::message_t& msg, std::vector<unsigned> bl,
-                           size_t offset);
+    size_t encodeBlackList(unsigned char* msg, const std::vector<unsigned char>& black_cells,
+                           size_t offset) const;
 
     /**
      * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
-     * Decodes the point cloud grid blacklist for given msg,
-     * which contains the index of all cells not containing any data.
-     * Decoding is started at msg.data() + offset.
-     * Returns offset after extracting from msg.
+     * Decodes the point cloud grid blacklist into black_cells,
+     * which is resized to the number of cells of the grid.
+     * Decoding is started at msg + offset.
+     * Returns offset after extracting from msg, 0 if the blacklist is invalid.
+    */
+    size_t decodeBlackList(const Context& ctx, const unsigned char* msg, std::vector<unsigned char>& black_cells,
+                           size_t offset) const;
+
+    /**
+     * Initializes c_header from the cell at cell_idx of Context::pc_grid_.
+    */
+    void initCellHeader(const Context& ctx, unsigned cell_idx, CellHeader* c_header) const;
+
+    /**
+     * Returns the encoded size of c_header in the format of GlobalHeader::format_version.
+     * prev is the header encoded before c_header, or nullptr
+     * if the precision of c_header may not refer to it.
     */
-    size_t decodeBlackList(zmq::message_t& msg, std::vector<unsigned>& bl,
-                           size_t offset);
+    size_t calcCellHeaderSize(const Context& ctx, const CellHeader* c_header, const CellHeader* prev) const;
 
     /**
      * Helper function for PointCloudGridEncoder::encodePointCloudGrid.
-     * Encodes given PointCloudGridEncoder::CellHeader into given msg
-     * at msg.data() + offset.
+     * Encodes given PointCloudGridEncoder::CellHeader
+     * at msg + offset, see calcCellHeaderSize for prev.
      * Returns offset after extending msg.
     */
-    size_t encodeCellHeader(zmq::message_t& msg, CellHeader* c_header, size_t offset);
+    size_t encodeCellHeader(Context& ctx, unsigned char* msg, const CellHeader* c_header, const CellHeader* prev,
+                            size_t offset) const;
 
     /**
      * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
      * Decodes a PointCloudGridEncoder::CellHeader into given c_header
-     * at msg.data() + offset.
-     * Returns offset after extracting from msg.
+     * at msg + offset, see calcCellHeaderSize for prev.
+     * Returns offset after extracting from msg, 0 if the header is invalid.
+    */
+    size_t decodeCellHeader(Context& ctx, const unsigned char* msg, CellHeader* c_header, const CellHeader* prev,
+                            size_t offset) const;
+
+    /**
+     * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
+     * Decodes the headers of all white_cells (in message order) starting at msg + offset,
+     * either by walking all cell headers or, if GridHeader::offset_table is set,
+     * in parallel from the offset table at msg + offset.
+     * Using the offset table, headers of cells not selected are not decoded.
+     * cell_headers receives the headers, cell_offsets the offsets of corresponding cell data,
+     * both have to be of the size of white_cells.
+     * Returns false if a cell exceeds the message.
     */
-    size_t decodeCellHeader(zmq::message_t& msg, CellHeader* c_header, size_t offset);
+    bool decodeCellHeaders(Context& ctx, const unsigned char* msg, size_t offset,
+                           const std::vector<unsigned>& white_cells,
+                           const std::vector<unsigned char>& selected,
+                           std::vector<CellHeader>& cell_headers,
+                           std::vector<size_t>& cell_offsets) const;
 
     /**
      * Helper function for PointCloudGridEncoder::encodePointCloudGrid.
-     * Encodes given PointCloudGrid::GridCell into given msg
-     * at msg.data() + offset.
+     * Encodes the PointCloudGrid::GridCell at cell_idx
+     * at msg + offset.
      * Returns offset after extending msg.
     */
-    size_t encodeCell(zmq::message_t &msg, GridCell* cell, size_t offset);
+    size_t encodeCell(Context& ctx, unsigned char* msg, unsigned cell_idx, size_t offset) const;
 
     /**
      * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
-     * Decodes a PointCloudGrid::GridCell into PointCloudGridEncoder::pc_grid_
-     * given meta data provided by CellHeader from given msg at msg.data() + offset.
-     * Returns offset after extracting from msg.
+     * Decodes a PointCloudGrid::GridCell into Context::pc_grid_
+     * given meta data provided by CellHeader from given msg at msg + offset.
+     * Cell data is unpacked in place, without copying it out of msg,
+     * octree coded positions are decoded using scratch.
+     * Returns offset after extracting from msg, or 0 if coded cell data is invalid.
     */
-    size_t decodeCell(zmq::message_t &msg, CellHeader *c_header, size_t offset);
+    size_t decodeCell(Context& ctx, const unsigned char* msg, CellHeader *c_header, size_t offset,
+                      OctreeScratch& scratch) const;
 
     /**
      * Calculates the index of the cell given point belongs to.
      * cell_range describes the x/y/z-sizes of a GridCell.
     */
-    unsigned calcGridCellIndex(const float pos[3], const Vec<float>& cell_range) const;
+    unsigned calcGridCellIndex(const Context& ctx, const float pos[3], const Vec<float>& cell_range) const;
+
+    /**
+     * Calculates the volume covered by the cell at cell_idx.
+     * cell_range describes the x/y/z-sizes of a GridCell.
+    */
+    BoundingBox calcGridCellBoundingBox(const Context& ctx, unsigned cell_idx, const Vec<float>& cell_range) const;
 
     /**
      * Map given point into the local coordinate system of a cell.
     */
-    const Vec<float> mapToCell(const float pos[3], const Vec<float>& cell_range);
+    const Vec<float> mapToCell(const Context& ctx, const float pos[3], const Vec<float>& cell_range) const;
+
+    /**
+     * Calculates the size of the message encoding current
+     * Context::pc_grid_ in Bytes, excluding GlobalHeader and appendix.
+    */
+    size_t calcGridMessageSize(const Context& ctx) const;
+
+    /**
+     * Returns the size of the encoded data of the cell at cell_idx,
+     * excluding its CellHeader.
+    */
+    size_t calcCellDataSize(const Context& ctx, unsigned cell_idx) const;
+
+    /**
+     * Returns the size of the encoded data of the cell described by c_header,
+     * which starts at msg + offset.
+    */
+    size_t calcCellDataSize(const Context& ctx, const unsigned char* msg, const CellHeader* c_header,
+                            size_t offset) const;
+
+    /**
+     * Returns true if cells of the current message are range coded (ENTROPY_RANGE)
+     * instead of being bit packed.
+    */
+    bool isRangeCoded(const Context& ctx) const;
+
+    /**
+     * Returns true if cell positions of the current message are octree coded.
+    */
+    bool isOctreeCoded(const Context& ctx) const;
+
+    /**
+     * Returns true if cells of the current message are coded into variable sized data
+     * prior to message encoding (range or octree coding),
+     * such data is preceded by its size within the message.
+    */
+    bool hasPrecodedCells(const Context& ctx) const;
+
+    /**
+     * Range or octree codes all cells of Context::pc_grid_ sent with
+     * the current frame in parallel into Context::coded_cells_.
+    */
+    void precodeCells(Context& ctx) const;
+
+    /**
+     * Decides whether the current Context::pc_grid_ is encoded
+     * as keyframe or delta frame and fills Context::cell_skipped_
+     * for cells unchanged w.r.t. Context::ref_grid_.
+     * Fills Context::header_ frame info accordingly
+     * and flags cells without points in FrameArena::black_cells.
+    */
+    void selectSkippedCells(Context& ctx) const;
+
+    /**
+     * Copies all cells sent with the current frame into Context::ref_grid_,
+     * such that it equals the grid reconstructed by the decoder.
+    */
+    void updateReferenceGrid(Context& ctx) const;
+
+    /**
+     * Returns true if the cell at cell_idx is encoded with CellHeader and data.
+    */
+    bool isCellSent(const Context& ctx, unsigned cell_idx) const;
+
+    /**
+     * Hashes the content of all cells sent with the current frame in parallel
+     * and sets Context::cell_cached_ for cells, whose encoded data
+     * from a previous frame is still valid. Cells with equal hash are compared
+     * to the cached content, so hash collisions do not reuse wrong data.
+     * Only used if settings.cell_caching is set.
+    */
+    void hashCells(Context& ctx) const;
+
+    /**
+     * Helper function for PointCloudGridEncoder::encodePointCloudGrid.
+     * Encodes the indexes of all cells skipped in a delta frame.
+     * Encoding is started at msg + offset.
+     * Returns offset after extending msg.
+    */
+    size_t encodeSkipList(unsigned char* msg, const std::vector<unsigned>& sl, size_t offset) const;
+
+    /**
+     * Helper function for PointCloudGridEncoder::decodePointCloudGrid.
+     * Decodes Context::header_.num_skipped indexes of cells skipped in a delta frame.
+     * Decoding is started at msg + offset.
+     * Returns offset after extracting from msg.
+    */
+    size_t decodeSkipList(const Context& ctx, const unsigned char* msg, std::vector<unsigned>& sl, size_t offset) const;
+
+    /**
+     * Returns given executor running asynchronous calls, starting it on first use.
+    */
+    SerialExecutor& getExecutor(std::unique_ptr<SerialExecutor>& executor, std::once_flag& started);
+
+    /**
+     * Returns the number of threads per parallel loop,
+     * as given by settings.num_threads and limited by the thread pool.
+    */
+    unsigned getNumThreads() const;
+
+    /**
+     * Returns the number of threads actually running a parallel loop,
+     * getNumThreads limited by max_loop_threads_. Messages do not depend on it.
+    */
+    unsigned getLoopThreads() const;
+
+    /**
+     * Calls fn(i) for every i in [begin, end) in parallel on the thread pool.
+     * grain is passed to ThreadPool::parallelFor.
+    */
+    template<typename F>
+    void parallelFor(size_t begin, size_t end, const F& fn, size_t grain = 0) const
+    {
+        thread_pool_->parallelFor(begin, end, getLoopThreads(), fn, grain);
+    }
 
     /**
-     * Calculates the overall size of a poiunt cloud grid message in Bytes.
+     * Calls fn(i, scratch) for every i in [0, n) in parallel.
+     * Indexes are split into blocks of consecutive indexes,
+     * each using an OctreeScratch of ctx.arena_ of its own.
     */
-    size_t calcMessageSize(const std::vector<CellHeader*>&) const;
+    template<typename F>
+    void parallelForScratch(Context& ctx, size_t n, const F& fn) const
+    {
+        size_t num_blocks = std::min<size_t>(n, 4 * size_t(getLoopThreads()));
+        std::vector<OctreeScratch>& scratches = ctx.arena_.octree_scratches;
+        if(scratches.size() < num_blocks)
+            scratches.resize(num_blocks);
+        parallelFor(0, num_blocks, [&](size_t b) {
+            for(size_t i = n * b / num_blocks; i < n * (b + 1) / num_blocks; ++i)
+                fn(i, scratches[b]);
+        }, 1);
+    }
 
-    PointCloudGrid* pc_grid_;
-    GridHeader* header_;
-    GlobalHeader* global_header_;
+    // not owned
+    ThreadPool* thread_pool_;
+    // limits parallel loops without changing messages, 0 for no limit,
+    // used by PointCloudStreamEncoder to share the pool among its stages
+    unsigned max_loop_threads_;
+    // runs encodeAsync calls, started by the first one
+    std::unique_ptr<SerialExecutor> executor_;
+    std::once_flag executor_started_;
+    // runs decodeAsync calls, started by the first one
+    std::unique_ptr<SerialExecutor> decode_executor_;
+    std::once_flag decode_executor_started_;
+    // state of calls not given a Context
+    Context context_;
+    // state of decodeAsync calls
+    Context decode_context_;
+    // state of encodeBatch per cloud index, grown to the largest batch
+    std::vector<Context*> batch_contexts_;
 };
 
 
@@ -0,0 +1,156 @@
+#ifndef LIBPCC_POINT_CLOUD_STREAM_ENCODER_HPP
+#define LIBPCC_POINT_CLOUD_STREAM_ENCODER_HPP
+
+#include "PointCloudGridEncoder.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Encodes a sequence of point clouds, overlapping the encoding stages of consecutive frames.
+ * Every frame passes three stages, each running on a thread of its own:
+ * building the grid, packing the grid message including temporal coding,
+ * and entropy coding into the final message. Thus frame N is compressed
+ * while frame N+1 is packed and frame N+2 is quantized. The stages share
+ * one ThreadPool, each running its parallel loops on a third of its threads,
+ * such that the stages together do not run more threads than the pool.
+ * If a message cannot be compressed, delta frames packed after it are dropped
+ * as well until the next keyframe, as they refer to the lost frame.
+ * At most max_frames frames are in flight, which bounds latency and memory.
+ * Messages are identical to those of PointCloudGridEncoder::encode
+ * for the same settings and sequence of point clouds.
+*/
+class PointCloudStreamEncoder {
+public:
+    /**
+     * Starts the stage threads. Settings are fixed for the whole stream.
+     * Parallel loops run on given pool, or on ThreadPool::getDefault() if nullptr.
+    */
+    explicit PointCloudStreamEncoder(const PointCloudGridEncoder::EncodingSettings& s =
+                                         PointCloudGridEncoder::EncodingSettings(),
+                                     unsigned max_frames = 3, ThreadPool* pool = nullptr);
+
+    /**
+     * Stops the stage threads after the frames they are working on.
+     * Frames not popped yet are discarded.
+    */
+    ~PointCloudStreamEncoder();
+
+    PointCloudStreamEncoder(const PointCloudStreamEncoder&) = delete;
+    PointCloudStreamEncoder& operator=(const PointCloudStreamEncoder&) = delete;
+
+    /**
+     * Queues a copy of given point_cloud for encoding,
+     * num_points is handled as described for PointCloudGridEncoder::encode.
+     * Blocks while max_frames frames are in flight, until the oldest message is popped.
+     * Returns false if the stream is closed.
+    */
+    bool push(const std::vector<UncompressedVoxel>& point_cloud, int num_points = -1);
+
+    /**
+     * Moves the message of the oldest frame not popped yet into msg,
+     * blocking until it is encoded. Messages are popped in order of push.
+     * An empty message denotes a frame which could not be encoded.
+     * Returns false once the stream is closed and all messages have been popped.
+    */
+    bool pop(zmq::message_t& msg);
+
+    /**
+     * Like pop, but returns false immediately if the oldest message is not yet encoded.
+    */
+    bool tryPop(zmq::message_t& msg);
+
+    /**
+     * Ends the stream. Subsequent calls to push fail,
+     * frames pushed before are still encoded and can be popped.
+    */
+    void close();
+
+    /**
+     * Forces the next frame to be packed to be a keyframe,
+     * see PointCloudGridEncoder::requestKeyframe.
+    */
+    void requestKeyframe();
+
+    const PointCloudGridEncoder::EncodingSettings& getSettings() const;
+
+private:
+    /**
+     * Progress of a frame, stages are run in this order.
+    */
+    enum FrameState {
+        FRAME_FREE,
+        FRAME_FILLING,
+        FRAME_PUSHED,
+        FRAME_BUILT,
+        FRAME_PACKED,
+        FRAME_ENCODED,
+        FRAME_POPPING
+    };
+
+    /**
+     * Data of a frame in flight, reused for later frames.
+    */
+    struct Frame {
+        Frame();
+
+        FrameState state;
+        std::vector<UncompressedVoxel> points;
+        // grid swapped into the stage contexts
+        PointCloudGrid* grid;
+        // set by packing stage
+        bool valid;
+        bool delta_frame;
+        PointCloudGridEncoder::GlobalHeader header;
+        const EntropyCoder* coder;
+        std::vector<unsigned char> grid_message;
+        std::vector<size_t> cell_offsets;
+        // set by entropy coding stage
+        zmq::message_t msg;
+    };
+
+    /**
+     * Runs one stage on all frames in order, changing the state of processed frames
+     * from input to output, until the stream encoder is destroyed.
+    */
+    void runStage(FrameState input, FrameState output);
+
+    /**
+     * Stages run by runStage.
+    */
+    void buildFrame(Frame& frame);
+    void packFrame(Frame& frame);
+    void compressFrame(Frame& frame);
+
+    /**
+     * Moves the message of the oldest frame into msg, requires lock on mutex_.
+    */
+    void popFrame(std::unique_lock<std::mutex>& lock, zmq::message_t& msg);
+
+    // encoder and context per stage, encoders differ in their share of the pool only,
+    // packer_ctx_ holds the temporal coding state
+    PointCloudGridEncoder builder_;
+    PointCloudGridEncoder packer_;
+    PointCloudGridEncoder compressor_;
+    PointCloudGridEncoder::Context builder_ctx_;
+    PointCloudGridEncoder::Context packer_ctx_;
+    PointCloudGridEncoder::Context compressor_ctx_;
+    // set by compression stage after a lost message until the next keyframe
+    bool reference_lost_;
+
+    std::vector<Frame> frames_;
+    // index of next frame to push and to pop
+    size_t push_idx_;
+    size_t pop_idx_;
+    bool closed_;
+    bool stopped_;
+    std::atomic<bool> keyframe_requested_;
+    std::mutex mutex_;
+    std::condition_variable state_cv_;
+    std::vector<std::thread> stages_;
+};
+
+#endif //LIBPCC_POINT_CLOUD_STREAM_ENCODER_HPP
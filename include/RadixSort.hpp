@@ -0,0 +1,40 @@
+#ifndef LIBPCC_RADIX_SORT_HPP
+#define LIBPCC_RADIX_SORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * Data transfer object for sorting by a 64 bit key.
+ * value usually references an element in a separate container.
+*/
+struct KeyValuePair {
+    uint64_t key;
+    unsigned value;
+};
+
+/**
+ * Buffers used by radixSort.
+ * Keeping them across calls avoids allocations for inputs of similar size.
+*/
+struct RadixSortScratch {
+    std::vector<KeyValuePair> buffer;
+    std::vector<size_t> histograms;
+};
+
+/**
+ * Stable parallel LSD radix sort of data by KeyValuePair::key.
+ * Only the lower key_bits bits of each key are considered.
+ * Keys are processed in 8 bit digits. data is split into one block per thread,
+ * each block counting its digits in a histogram of its own.
+ * Digits equal among all keys are skipped.
+ * scratch.buffer is used as double buffer and will be resized to data.size(),
+ * it might be swapped with data.
+*/
+void radixSort(std::vector<KeyValuePair>& data, RadixSortScratch& scratch, unsigned key_bits,
+               ThreadPool& pool, unsigned num_threads);
+
+#endif //LIBPCC_RADIX_SORT_HPP
@@ -0,0 +1,179 @@
+#ifndef LIBPCC_RANGE_CODER_HPP
+#define LIBPCC_RANGE_CODER_HPP
+
+#include "BitVecArray.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Adaptive probability of a binary symbol being 0,
+ * scaled to RangeEncoder::PROB_BITS bits.
+*/
+typedef uint16_t BitProb;
+
+/**
+ * Binary adaptive range encoder.
+ * Each bit is coded with a BitProb, which is adapted towards the coded value.
+ * Output is appended to a byte vector.
+*/
+class RangeEncoder {
+public:
+    static const unsigned PROB_BITS = 11;
+    static const BitProb PROB_INIT = 1 << (PROB_BITS - 1);
+    static const unsigned ADAPT_SHIFT = 5;
+
+    explicit RangeEncoder(std::vector<unsigned char>& t_out)
+        : out_(t_out)
+        , low_(0)
+        , range_(0xFFFFFFFF)
+        , cache_(0)
+        , cache_size_(1)
+    {}
+
+    void encodeBit(BitProb& prob, unsigned bit)
+    {
+        uint32_t bound = (range_ >> PROB_BITS) * prob;
+        if(bit == 0) {
+            range_ = bound;
+            prob += ((1 << PROB_BITS) - prob) >> ADAPT_SHIFT;
+        }
+        else {
+            low_ += bound;
+            range_ -= bound;
+            prob -= prob >> ADAPT_SHIFT;
+        }
+        while(range_ < TOP) {
+            range_ <<= 8;
+            shiftLow();
+        }
+    }
+
+    /**
+     * Writes all pending bytes to the output.
+    */
+    void flush()
+    {
+        for(unsigned i = 0; i < 5; ++i)
+            shiftLow();
+    }
+
+private:
+    static const uint32_t TOP = 1 << 24;
+
+    void shiftLow()
+    {
+        if(static_cast<uint32_t>(low_) < 0xFF000000 || (low_ >> 32) != 0) {
+            auto carry = static_cast<unsigned char>(low_ >> 32);
+            unsigned char temp = cache_;
+            do {
+                out_.push_back(static_cast<unsigned char>(temp + carry));
+                temp = 0xFF;
+            } while(--cache_size_ != 0);
+            cache_ = static_cast<unsigned char>(low_ >> 24);
+        }
+        ++cache_size_;
+        low_ = (low_ & 0x00FFFFFF) << 8;
+    }
+
+    std::vector<unsigned char>& out_;
+    uint64_t low_;
+    uint32_t range_;
+    unsigned char cache_;
+    uint64_t cache_size_;
+};
+
+/**
+ * Binary adaptive range decoder matching RangeEncoder.
+ * Reading past the end of input yields zero bytes.
+*/
+class RangeDecoder {
+public:
+    RangeDecoder(const unsigned char* t_in, size_t size)
+        : in_(t_in)
+        , end_(t_in + size)
+        , range_(0xFFFFFFFF)
+        , code_(0)
+        , overrun_(false)
+    {
+        for(unsigned i = 0; i < 5; ++i)
+            code_ = (code_ << 8) | nextByte();
+    }
+
+    unsigned decodeBit(BitProb& prob)
+    {
+        uint32_t bound = (range_ >> RangeEncoder::PROB_BITS) * prob;
+        unsigned bit;
+        if(code_ < bound) {
+            range_ = bound;
+            prob += ((1 << RangeEncoder::PROB_BITS) - prob) >> RangeEncoder::ADAPT_SHIFT;
+            bit = 0;
+        }
+        else {
+            code_ -= bound;
+            range_ -= bound;
+            prob -= prob >> RangeEncoder::ADAPT_SHIFT;
+            bit = 1;
+        }
+        while(range_ < (1 << 24)) {
+            range_ <<= 8;
+            code_ = (code_ << 8) | nextByte();
+        }
+        return bit;
+    }
+
+    /**
+     * Returns true if decoding read past the end of input,
+     * which a complete stream of RangeEncoder never does.
+    */
+    bool isOverrun() const
+    {
+        return overrun_;
+    }
+
+private:
+    uint32_t nextByte()
+    {
+        if(in_ < end_)
+            return *in_++;
+        overrun_ = true;
+        return 0;
+    }
+
+    const unsigned char* in_;
+    const unsigned char* end_;
+    uint32_t range_;
+    uint32_t code_;
+    bool overrun_;
+};
+
+/**
+ * Range codes all elements of points & colors, which have to be of equal size,
+ * and appends the result to out.
+ * Every component is coded as residual to the same component of the previous element,
+ * binarized into its bit length and the bits below the leading one.
+ * Contexts are selected by component and by whether more significant position components
+ * of the element changed. The BitCount of a component bounds the bit length of its residuals,
+ * thus sets the depth of the binary tree coding the bit length.
+ * Elements sorted by position (z, y, x) thus yield small residuals.
+*/
+void rangeEncodeCell(const BitVecArray& points, const BitVecArray& colors,
+                     std::vector<unsigned char>& out);
+
+/**
+ * Decodes num_elmnts elements encoded by rangeEncodeCell from size bytes of data
+ * into points & colors. BitCounts of points & colors have to be initialized
+ * to the values used for encoding.
+ * Returns false without decoding if size bytes cannot hold num_elmnts elements,
+ * or if decoding read past the end of data.
+*/
+bool rangeDecodeCell(const unsigned char* data, size_t size, size_t num_elmnts,
+                     BitVecArray& points, BitVecArray& colors);
+
+/**
+ * Returns the maximum number of bytes written by rangeEncodeCell
+ * for num_elmnts elements using given total number of bits per element.
+*/
+size_t calcMaxRangeCodedSize(size_t num_elmnts, size_t elmnt_bits);
+
+#endif //LIBPCC_RANGE_CODER_HPP
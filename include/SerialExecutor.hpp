@@ -0,0 +1,42 @@
+#ifndef LIBPCC_SERIAL_EXECUTOR_HPP
+#define LIBPCC_SERIAL_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * Runs submitted tasks one after another in order of submission
+ * on a thread of its own. Tasks may be submitted from any thread.
+*/
+class SerialExecutor {
+public:
+    SerialExecutor();
+
+    /**
+     * Runs all tasks submitted before, then stops the thread.
+    */
+    ~SerialExecutor();
+
+    SerialExecutor(const SerialExecutor&) = delete;
+    SerialExecutor& operator=(const SerialExecutor&) = delete;
+
+    /**
+     * Queues task to be run after all tasks submitted before.
+     * Exceptions escaping task are reported and do not stop later tasks.
+    */
+    void submit(std::function<void()> task);
+
+private:
+    void work();
+
+    std::deque<std::function<void()>> tasks_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable task_cv_;
+    std::thread thread_;
+};
+
+#endif //LIBPCC_SERIAL_EXECUTOR_HPP
@@ -0,0 +1,109 @@
+#ifndef LIBPCC_THREAD_POOL_HPP
+#define LIBPCC_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Persistent worker threads executing parallel loops.
+ * A loop is split into tasks of consecutive indexes, which are claimed
+ * by the calling thread and idle workers alike. Thus loops of several callers
+ * share the workers, and nested loops proceed on the calling thread
+ * if all workers are busy. Running a loop does not allocate memory.
+*/
+class ThreadPool {
+public:
+    /**
+     * Starts num_threads - 1 workers, the thread running a loop is the last one.
+     * 0 selects the number of hardware threads.
+    */
+    explicit ThreadPool(unsigned num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Returns the maximum number of threads running a loop, including the calling thread.
+    */
+    unsigned getNumThreads() const;
+
+    /**
+     * Calls fn(i) for every i in [begin, end) on up to max_threads threads,
+     * returns once all calls are finished.
+     * Threads claim grain consecutive indexes at once. 0 selects a grain
+     * of about four tasks per thread, 1 suits iterations of varying cost.
+     * max_threads of 0 allows all threads of the pool.
+     * If fn throws, remaining tasks are skipped and the first exception
+     * is rethrown on the calling thread once all running calls are finished.
+    */
+    template<typename F>
+    void parallelFor(size_t begin, size_t end, unsigned max_threads, const F& fn, size_t grain = 0);
+
+    /**
+     * Returns the pool shared by all users not providing their own,
+     * started on first use with one thread per hardware thread.
+    */
+    static ThreadPool& getDefault();
+
+private:
+    /**
+     * Parallel loop, located on the stack of the calling thread.
+    */
+    struct Loop {
+        // calls fn for indexes [begin, end)
+        void (*invoke)(const void* fn, size_t begin, size_t end);
+        const void* fn;
+        size_t end;
+        size_t grain;
+        std::atomic<size_t> next;
+        // set by the first task throwing, read by the caller after all tasks finished
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+        // guarded by mutex_
+        unsigned max_helpers;
+        unsigned num_helpers;
+        unsigned num_running;
+        bool queued;
+        Loop* next_queued;
+    };
+
+    void run(Loop& loop, size_t begin, unsigned max_threads);
+    void work();
+    void dequeue(Loop* loop);
+    static void runTasks(Loop& loop);
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    Loop* queue_head_;
+    Loop* queue_tail_;
+    bool stop_;
+};
+
+template<typename F>
+void ThreadPool::parallelFor(size_t begin, size_t end, unsigned max_threads, const F& fn, size_t grain)
+{
+    if(begin >= end)
+        return;
+    Loop loop;
+    loop.invoke = [](const void* f, size_t task_begin, size_t task_end) {
+        const F& func = *static_cast<const F*>(f);
+        for(size_t i = task_begin; i < task_end; ++i)
+            func(i);
+    };
+    loop.fn = &fn;
+    loop.end = end;
+    loop.grain = grain;
+    run(loop, begin, max_threads);
+    if(loop.error)
+        std::rethrow_exception(loop.error);
+}
+
+#endif //LIBPCC_THREAD_POOL_HPP
@@ -0,0 +1,69 @@
+#ifndef LIBPCC_VARINT_HPP
+#define LIBPCC_VARINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Variable length encoding of unsigned integers,
+ * 7 bits per byte starting with the least significant ones,
+ * the most significant bit of a byte marks that another byte follows.
+*/
+
+/**
+ * Returns the number of bytes used to encode value.
+*/
+inline size_t calcVarintSize(uint64_t value)
+{
+    size_t size = 1;
+    for(; value >= 0x80; value >>= 7)
+        ++size;
+    return size;
+}
+
+/**
+ * Encodes value at out + offset, which has to provide calcVarintSize(value) bytes.
+ * Returns offset after the varint.
+*/
+inline size_t writeVarint(unsigned char* out, size_t offset, uint64_t value)
+{
+    while(value >= 0x80) {
+        out[offset++] = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    out[offset++] = static_cast<unsigned char>(value);
+    return offset;
+}
+
+/**
+ * Appends the encoding of value to out.
+*/
+inline void writeVarint(std::vector<unsigned char>& out, uint64_t value)
+{
+    while(value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+/**
+ * Reads a varint from data + offset, advancing offset.
+ * Returns false if the varint exceeds size bytes or 64 bits.
+*/
+inline bool readVarint(const unsigned char* data, size_t size, size_t& offset, uint64_t& value)
+{
+    value = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7) {
+        if(offset >= size)
+            return false;
+        unsigned char byte = data[offset++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+#endif //LIBPCC_VARINT_HPP
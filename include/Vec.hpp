@@ -60,8 +60,17 @@ struct Vec {
         return h;
     }
 
+    /**
+     * Orders by z, y & x - component.
+     * Equals ordering by hash() for components of up to 8 bits,
+     * but does not collide for wider components.
+    */
     bool operator<(const Vec<C>& rhs) const {
-        return hash() < rhs.hash();
+        if(z != rhs.z)
+            return z < rhs.z;
+        if(y != rhs.y)
+            return y < rhs.y;
+        return x < rhs.x;
     }
 
     friend std::ostream& operator<< (std::ostream &out, const Vec<C>& rhs) 
@@ -1,7 +1,48 @@
 #include "BitVecArray.hpp"
+#include "BitPacker.hpp"
+#include "PackKernels.hpp"
+
+namespace {
+
+template <typename C>
+size_t packComponents(const ComponentArrays<C>& c, size_t first,
+                      BitCount nx, BitCount ny, BitCount nz, unsigned char* packed_data)
+{
+    BitPacker packer(packed_data);
+    for(size_t i = first; i < c.size(); ++i) {
+        packer.write(c.x[i], nx);
+        packer.write(c.y[i], ny);
+        packer.write(c.z[i], nz);
+    }
+    return packer.flush();
+}
+
+template <typename C>
+void unpackComponents(ComponentArrays<C>& c, size_t first,
+                      BitCount nx, BitCount ny, BitCount nz,
+                      const unsigned char* packed_data, size_t num_bytes)
+{
+    BitUnpacker unpacker(packed_data, num_bytes);
+    for(size_t i = first; i < c.size(); ++i) {
+        c.x[i] = static_cast<C>(unpacker.read(nx));
+        c.y[i] = static_cast<C>(unpacker.read(ny));
+        c.z[i] = static_cast<C>(unpacker.read(nz));
+    }
+}
+
+bool requiresWide(BitCount nx, BitCount ny, BitCount nz)
+{
+    return nx > BitVecArray::MAX_NARROW_BITS ||
+           ny > BitVecArray::MAX_NARROW_BITS ||
+           nz > BitVecArray::MAX_NARROW_BITS;
+}
+
+} // namespace
 
 BitVecArray::BitVecArray(BitCount t_NX, BitCount t_NY, BitCount t_NZ)
-        : data_()
+        : narrow_()
+        , wide_()
+        , is_wide_(requiresWide(t_NX, t_NY, t_NZ))
         , nx_(t_NX)
         , ny_(t_NY)
         , nz_(t_NZ)
@@ -17,17 +58,17 @@ size_t BitVecArray::getBitSize(size_t num_elmnts, BitCount nx, BitCount ny, BitC
 
 size_t BitVecArray::getBitSize() const
 {
-    return BitVecArray::getBitSize(data_.size(), nx_, ny_, nz_);
+    return BitVecArray::getBitSize(size(), nx_, ny_, nz_);
 }
 
 size_t BitVecArray::getByteSize(size_t num_elmnts, BitCount nx, BitCount ny, BitCount nz)
 {
-    return static_cast<size_t>(ceil(getBitSize(num_elmnts, nx, ny, nz)/8.0f));
+    return (getBitSize(num_elmnts, nx, ny, nz) + 7) / 8;
 }
 
 size_t BitVecArray::getByteSize() const
 {
-    return static_cast<size_t>(ceil(getBitSize()/8.0f));
+    return (getBitSize() + 7) / 8;
 }
 
 BitCount BitVecArray::getNX() const
@@ -53,130 +94,113 @@ void BitVecArray::init(BitCount t_NX, BitCount t_NY, BitCount t_NZ)
     nx_ = t_NX;
     ny_ = t_NY;
     nz_ = t_NZ;
+    is_wide_ = requiresWide(nx_, ny_, nz_);
 }
 
-Vec<uint64_t> const& BitVecArray::operator[](unsigned i) const
-{
-    return data_[i];
-}
-
-Vec<uint64_t>& BitVecArray::operator[](unsigned i)
-{
-    return data_[i];
-}
-
-void BitVecArray::unpack(unsigned char* packed_data, size_t num_elmnts)
-{
-    data_.clear();
-    data_.resize(num_elmnts);
-
-    size_t elmt_idx = 0;
-    size_t elmt_size = nx_+ny_+nz_;
-    size_t current_bit = 0;
-    std::bitset<8> byte;
-    BitVec bit_vec(0,0,0,nx_,ny_,nz_);
-    for(size_t i = 0; i < getByteSize(); ++i) {
-        byte = std::bitset<8>(static_cast<ulong>(packed_data[i]));
-        for(size_t byte_idx = 0; byte_idx < byte.size(); ++byte_idx) {
-            if(current_bit < nx_) {
-                bit_vec.setX(current_bit, byte[byte_idx]);
-            }
-            else if(current_bit < (size_t) nx_+ny_) {
-                bit_vec.setY(current_bit-nx_, byte[byte_idx]);
-            }
-            else {
-                bit_vec.setZ(current_bit-nx_-ny_, byte[byte_idx]);
-            }
-            current_bit = (current_bit + 1) % elmt_size;
-            if(current_bit == 0) {
-                data_[elmt_idx].x = bit_vec.getXInt();
-                data_[elmt_idx].y = bit_vec.getYInt();
-                data_[elmt_idx].z = bit_vec.getZInt();
-                elmt_idx++;
-                if(elmt_idx == data_.size())
-                    break;
-            }
-        }
-        if(elmt_idx == data_.size())
-            break;
-    }
+Vec<uint64_t> const BitVecArray::operator[](unsigned i) const
+{
+    return is_wide_ ? wide_.get(i) : narrow_.get(i);
 }
 
-unsigned char* BitVecArray::pack()
+void BitVecArray::set(unsigned i, const Vec<uint64_t>& v)
 {
-    auto* packed_data = new unsigned char[getByteSize()];
-    std::bitset<8> byte;
-    size_t current_byte = 0;
-    size_t bit_idx = 0;
-    BitVec bit_vec(0,0,0,nx_,ny_,nz_);
-    // Pack all BitVec
-    for(auto v: data_) {
-        // convert x,y,z (uint64_t) to bit string
-        bit_vec.setX(v.x);
-        bit_vec.setY(v.y);
-        bit_vec.setZ(v.z);
-        // pack x-component
-        for(size_t i = 0; i < nx_; ++i) {
-            byte[bit_idx] = bit_vec.getX()->getBit(i);
-            bit_idx = (bit_idx + 1) % 8;
-            if(bit_idx == 0) {
-                packed_data[current_byte] = static_cast<unsigned char>(byte.to_ulong());
-                ++current_byte;
-            }
-        }
-        // pack y-component
-        for(size_t i = 0; i < ny_; ++i) {
-            byte[bit_idx] = bit_vec.getY()->getBit(i);
-            bit_idx = (bit_idx + 1) % 8;
-            if(bit_idx == 0) {
-                packed_data[current_byte] = static_cast<unsigned char>(byte.to_ulong());
-                ++current_byte;
-            }
-        }
-        // pack z-component
-        for(size_t i = 0; i < nz_; ++i) {
-            byte[bit_idx] = bit_vec.getZ()->getBit(i);
-            bit_idx = (bit_idx + 1) % 8;
-            if(bit_idx == 0) {
-                packed_data[current_byte] = static_cast<unsigned char>(byte.to_ulong());
-                ++current_byte;
-            }
-        }
+    if(is_wide_)
+        wide_.set(i, v.x, v.y, v.z);
+    else
+        narrow_.set(i, v.x, v.y, v.z);
+}
+
+bool BitVecArray::isWide() const
+{
+    return is_wide_;
+}
+
+const ComponentArrays<uint16_t>& BitVecArray::getNarrow() const
+{
+    return narrow_;
+}
+
+const ComponentArrays<uint32_t>& BitVecArray::getWide() const
+{
+    return wide_;
+}
+
+void BitVecArray::unpack(const unsigned char* packed_data, size_t num_elmnts)
+{
+    clear();
+    resize(static_cast<unsigned>(num_elmnts));
+
+    if(is_wide_) {
+        unpackComponents(wide_, 0, nx_, ny_, nz_, packed_data, getByteSize());
+        return;
     }
 
-    // add padding for last byte if necessary
-    if(bit_idx != 0) {
-        while(bit_idx != 0) {
-            byte[bit_idx] = false;
-            bit_idx = (bit_idx + 1) % 8;
-        }
-        packed_data[current_byte] = static_cast<unsigned char>(byte.to_ulong());
+    // blocks with specialized kernel, remainder element wise
+    size_t num_blocks = 0;
+    const PackKernels* kernels = findPackKernels(nx_, ny_, nz_);
+    if(kernels != nullptr) {
+        num_blocks = num_elmnts / PACK_BLOCK_SIZE;
+        kernels->unpack(packed_data, num_blocks, narrow_.x.data(), narrow_.y.data(), narrow_.z.data());
     }
 
+    size_t block_bytes = num_blocks * (nx_+ny_+nz_);
+    unpackComponents(narrow_, num_blocks * PACK_BLOCK_SIZE, nx_, ny_, nz_,
+                     packed_data + block_bytes, getByteSize() - block_bytes);
+}
+
+unsigned char* BitVecArray::pack() const
+{
+    auto* packed_data = new unsigned char[getByteSize()];
+    pack(packed_data);
     return packed_data;
 }
 
+size_t BitVecArray::pack(unsigned char* packed_data) const
+{
+    if(is_wide_)
+        return packComponents(wide_, 0, nx_, ny_, nz_, packed_data);
+
+    // blocks with specialized kernel, remainder element wise
+    size_t num_blocks = 0;
+    const PackKernels* kernels = findPackKernels(nx_, ny_, nz_);
+    if(kernels != nullptr) {
+        num_blocks = narrow_.size() / PACK_BLOCK_SIZE;
+        kernels->pack(narrow_.x.data(), narrow_.y.data(), narrow_.z.data(), num_blocks, packed_data);
+    }
+
+    size_t block_bytes = num_blocks * (nx_+ny_+nz_);
+    return block_bytes + packComponents(narrow_, num_blocks * PACK_BLOCK_SIZE, nx_, ny_, nz_,
+                                        packed_data + block_bytes);
+}
+
 void BitVecArray::push_back(const Vec<uint64_t>& v)
 {
-    data_.push_back(v);
+    emplace_back(v.x, v.y, v.z);
 }
 
 void BitVecArray::emplace_back(uint64_t x, uint64_t y, uint64_t z)
 {
-    data_.emplace_back(x,y,z);
+    if(is_wide_)
+        wide_.push_back(x, y, z);
+    else
+        narrow_.push_back(x, y, z);
 }
 
 unsigned BitVecArray::size() const
 {
-    return static_cast<unsigned>(data_.size());
+    return static_cast<unsigned>(is_wide_ ? wide_.size() : narrow_.size());
 }
 
 void BitVecArray::resize(unsigned s)
 {
-    data_.resize(s);
+    if(is_wide_)
+        wide_.resize(s);
+    else
+        narrow_.resize(s);
 }
 
 void BitVecArray::clear()
 {
-    data_.clear();
+    narrow_.clear();
+    wide_.clear();
 }
@@ -0,0 +1,504 @@
+#include "EntropyCoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "zlib.h"
+
+namespace {
+
+voidpf allocZlibBlock(voidpf opaque, uInt items, uInt size)
+{
+    auto workspace = static_cast<EntropyWorkspace*>(opaque);
+    return workspace->acquire(static_cast<size_t>(items) * size);
+}
+
+void freeZlibBlock(voidpf opaque, voidpf address)
+{
+    auto workspace = static_cast<EntropyWorkspace*>(opaque);
+    workspace->release(address);
+}
+
+/**
+ * Returns a z_stream allocating through given workspace,
+ * or through the zlib default allocator if workspace is nullptr.
+*/
+z_stream createZlibStream(EntropyWorkspace* workspace)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if(workspace != nullptr) {
+        stream.zalloc = allocZlibBlock;
+        stream.zfree = freeZlibBlock;
+        stream.opaque = workspace;
+    }
+    return stream;
+}
+
+/**
+ * Deflate stream kept open in an EntropyWorkspace,
+ * reset for every message instead of being set up again.
+*/
+class DeflateState : public EntropyWorkspace::CoderState {
+public:
+    DeflateState(EntropyWorkspace& workspace, int level)
+        : stream_(createZlibStream(&workspace))
+        , level_(level)
+        , valid_(deflateInit(&stream_, level) == Z_OK)
+    {}
+
+    void close(EntropyWorkspace& workspace) override
+    {
+        if(!valid_)
+            return;
+        stream_.opaque = &workspace;
+        deflateEnd(&stream_);
+        valid_ = false;
+    }
+
+    /**
+     * Returns the stream reset for a new message, allocating through given workspace,
+     * or nullptr if it was not initialized.
+    */
+    z_stream* reset(EntropyWorkspace& workspace)
+    {
+        if(!valid_)
+            return nullptr;
+        // workspace may have been moved since the last call
+        stream_.opaque = &workspace;
+        return deflateReset(&stream_) == Z_OK ? &stream_ : nullptr;
+    }
+
+    int getLevel() const
+    {
+        return level_;
+    }
+
+private:
+    z_stream stream_;
+    int level_;
+    bool valid_;
+};
+
+/**
+ * Refills exhausted input and output of stream from the remaining sizes,
+ * which may exceed the range of uInt.
+*/
+void feedZlibStream(z_stream& stream, size_t& in_left, size_t& out_left)
+{
+    const auto max_avail = static_cast<size_t>(static_cast<uInt>(-1));
+    if(stream.avail_in == 0) {
+        stream.avail_in = static_cast<uInt>(std::min(in_left, max_avail));
+        in_left -= stream.avail_in;
+    }
+    if(stream.avail_out == 0) {
+        stream.avail_out = static_cast<uInt>(std::min(out_left, max_avail));
+        out_left -= stream.avail_out;
+    }
+}
+
+/**
+ * EntropyCoder using zlib deflate.
+ * level is the zlib compression level in range [0,9].
+*/
+class ZlibCoder : public EntropyCoder {
+public:
+    EntropyBackend getBackend() const override
+    {
+        return ENTROPY_ZLIB;
+    }
+
+    size_t calcMaxCompressedSize(size_t size) const override
+    {
+        return compressBound(size);
+    }
+
+    /**
+     * Deflate codes at most 258 bytes per 2 bits, a ratio of 1032:1.
+    */
+    size_t calcMaxDecompressedSize(size_t size) const override
+    {
+        return size * 1032;
+    }
+
+    /**
+     * Equivalent to zlib compress2. Given a workspace, the stream is kept open in it
+     * and reset for subsequent calls of the same level, which produces the same output
+     * at a fraction of the setup cost for small inputs.
+    */
+    size_t compress(const unsigned char* data, size_t size,
+                    unsigned char* out, size_t capacity, int level,
+                    EntropyWorkspace* workspace) const override
+    {
+        if(level < 0 || level > 9)
+            level = Z_DEFAULT_COMPRESSION;
+        if(workspace == nullptr) {
+            z_stream stream = createZlibStream(nullptr);
+            if(deflateInit(&stream, level) != Z_OK)
+                return 0;
+            size_t size_compressed = deflateAll(stream, data, size, out, capacity);
+            deflateEnd(&stream);
+            return size_compressed;
+        }
+        auto state = dynamic_cast<DeflateState*>(workspace->getCoderState());
+        if(state == nullptr || state->getLevel() != level) {
+            state = new DeflateState(*workspace, level);
+            workspace->setCoderState(state);
+        }
+        z_stream* stream = state->reset(*workspace);
+        return stream != nullptr ? deflateAll(*stream, data, size, out, capacity) : 0;
+    }
+
+    /**
+     * Equivalent to zlib uncompress, allocating through workspace.
+    */
+    bool decompress(const unsigned char* data, size_t size,
+                    unsigned char* out, size_t out_size,
+                    EntropyWorkspace* workspace) const override
+    {
+        z_stream stream = createZlibStream(workspace);
+        if(inflateInit(&stream) != Z_OK)
+            return false;
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.next_out = out;
+        size_t out_left = out_size;
+        int result = Z_OK;
+        while(result == Z_OK) {
+            feedZlibStream(stream, size, out_left);
+            result = inflate(&stream, Z_NO_FLUSH);
+        }
+        bool complete = result == Z_STREAM_END && stream.total_out == out_size;
+        inflateEnd(&stream);
+        return complete;
+    }
+
+private:
+    /**
+     * Compresses size bytes of data into out using stream, which is initialized.
+     * Returns compressed size, or 0 if capacity does not suffice.
+    */
+    static size_t deflateAll(z_stream& stream, const unsigned char* data, size_t size,
+                             unsigned char* out, size_t capacity)
+    {
+        // deflateReset keeps the buffer sizes left by the previous message
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.avail_in = 0;
+        stream.next_out = out;
+        stream.avail_out = 0;
+        int result = Z_OK;
+        while(result == Z_OK) {
+            feedZlibStream(stream, size, capacity);
+            result = deflate(&stream, size > 0 ? Z_NO_FLUSH : Z_FINISH);
+        }
+        return result == Z_STREAM_END ? stream.total_out : 0;
+    }
+};
+
+/**
+ * EntropyCoder using a byte oriented LZ77 variant.
+ * The stream is a sequence of tokens, each followed by
+ * literal bytes, a 16 bit match offset and a match length.
+ * The token holds literal length (upper 4 bits) and match length - MIN_MATCH (lower 4 bits).
+ * Lengths of 15 are continued by bytes added up until a byte < 255.
+ * The last token only holds literals.
+ * Matches are found through a single hash table lookup per position,
+ * level is ignored.
+*/
+class LzCoder : public EntropyCoder {
+public:
+    EntropyBackend getBackend() const override
+    {
+        return ENTROPY_LZ;
+    }
+
+    size_t calcMaxCompressedSize(size_t size) const override
+    {
+        return size + size / 255 + 16;
+    }
+
+    /**
+     * Every byte adds at most 255 bytes of match length.
+    */
+    size_t calcMaxDecompressedSize(size_t size) const override
+    {
+        return size * 255;
+    }
+
+    size_t compress(const unsigned char* data, size_t size,
+                    unsigned char* out, size_t capacity, int, EntropyWorkspace*) const override
+    {
+        uint32_t table[HASH_SIZE] = {};
+        const unsigned char* ip = data;
+        const unsigned char* anchor = data;
+        const unsigned char* end = data + size;
+        unsigned char* op = out;
+        unsigned char* out_end = out + capacity;
+
+        while(end - ip >= static_cast<ptrdiff_t>(MIN_MATCH)) {
+            uint32_t seq = read32(ip);
+            uint32_t& entry = table[hash(seq)];
+            const unsigned char* ref = data + entry;
+            // position 0 is never referenced, thus 0 denotes an empty entry
+            bool found = entry != 0 && ip - ref <= MAX_OFFSET && read32(ref) == seq;
+            entry = static_cast<uint32_t>(ip - data);
+            if(!found) {
+                ++ip;
+                continue;
+            }
+            size_t match_len = MIN_MATCH;
+            while(ip + match_len < end && ref[match_len] == ip[match_len])
+                ++match_len;
+            op = writeSequence(op, out_end, anchor, static_cast<size_t>(ip - anchor),
+                               static_cast<size_t>(ip - ref), match_len);
+            if(op == nullptr)
+                return 0;
+            ip += match_len;
+            anchor = ip;
+        }
+
+        op = writeSequence(op, out_end, anchor, static_cast<size_t>(end - anchor), 0, 0);
+        if(op == nullptr)
+            return 0;
+        return static_cast<size_t>(op - out);
+    }
+
+    bool decompress(const unsigned char* data, size_t size,
+                    unsigned char* out, size_t out_size, EntropyWorkspace*) const override
+    {
+        const unsigned char* ip = data;
+        const unsigned char* end = data + size;
+        unsigned char* op = out;
+        unsigned char* out_end = out + out_size;
+
+        while(ip < end) {
+            unsigned token = *ip++;
+            size_t literal_len = token >> 4;
+            if(literal_len == 15 && !readLength(ip, end, literal_len))
+                return false;
+            if(literal_len > static_cast<size_t>(end - ip) || literal_len > static_cast<size_t>(out_end - op))
+                return false;
+            memcpy(op, ip, literal_len);
+            ip += literal_len;
+            op += literal_len;
+            if(ip == end)
+                break;
+
+            if(end - ip < 2)
+                return false;
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            size_t match_len = token & 15;
+            if(match_len == 15 && !readLength(ip, end, match_len))
+                return false;
+            match_len += MIN_MATCH;
+            if(offset == 0 || offset > static_cast<size_t>(op - out) ||
+               match_len > static_cast<size_t>(out_end - op))
+                return false;
+            // byte wise, as source and destination may overlap
+            const unsigned char* ref = op - offset;
+            for(size_t i = 0; i < match_len; ++i)
+                op[i] = ref[i];
+            op += match_len;
+        }
+        return op == out_end;
+    }
+
+private:
+    static const unsigned HASH_BITS = 14;
+    static const unsigned HASH_SIZE = 1 << HASH_BITS;
+    static const size_t MIN_MATCH = 4;
+    static const ptrdiff_t MAX_OFFSET = 65535;
+
+    static uint32_t read32(const unsigned char* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t hash(uint32_t seq)
+    {
+        return (seq * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    static unsigned char* writeLength(unsigned char* op, size_t len)
+    {
+        for(; len >= 255; len -= 255)
+            *op++ = 255;
+        *op++ = static_cast<unsigned char>(len);
+        return op;
+    }
+
+    static bool readLength(const unsigned char*& ip, const unsigned char* end, size_t& len)
+    {
+        unsigned char b;
+        do {
+            if(ip == end)
+                return false;
+            b = *ip++;
+            len += b;
+        } while(b == 255);
+        return true;
+    }
+
+    /**
+     * Writes a sequence of literals followed by a match into op.
+     * A match_len of 0 denotes the last sequence without match.
+     * Returns position after sequence or nullptr if out_end would be exceeded.
+    */
+    static unsigned char* writeSequence(unsigned char* op, unsigned char* out_end,
+                                        const unsigned char* literals, size_t literal_len,
+                                        size_t offset, size_t match_len)
+    {
+        size_t max_len = 1 + literal_len / 255 + 1 + literal_len + 2 + match_len / 255 + 1;
+        if(max_len > static_cast<size_t>(out_end - op))
+            return nullptr;
+        size_t match_code = match_len == 0 ? 0 : match_len - MIN_MATCH;
+        unsigned char* token = op++;
+        *token = static_cast<unsigned char>((literal_len >= 15 ? 15 : literal_len) << 4);
+        if(literal_len >= 15)
+            op = writeLength(op, literal_len - 15);
+        memcpy(op, literals, literal_len);
+        op += literal_len;
+        if(match_len == 0)
+            return op;
+        *token |= static_cast<unsigned char>(match_code >= 15 ? 15 : match_code);
+        *op++ = static_cast<unsigned char>(offset);
+        *op++ = static_cast<unsigned char>(offset >> 8);
+        if(match_code >= 15)
+            op = writeLength(op, match_code - 15);
+        return op;
+    }
+};
+
+/**
+ * EntropyCoder copying data without compression.
+*/
+class StoreCoder : public EntropyCoder {
+public:
+    EntropyBackend getBackend() const override
+    {
+        return ENTROPY_STORE;
+    }
+
+    size_t calcMaxCompressedSize(size_t size) const override
+    {
+        return size;
+    }
+
+    size_t calcMaxDecompressedSize(size_t size) const override
+    {
+        return size;
+    }
+
+    size_t compress(const unsigned char* data, size_t size,
+                    unsigned char* out, size_t capacity, int, EntropyWorkspace*) const override
+    {
+        if(size > capacity)
+            return 0;
+        memcpy(out, data, size);
+        return size;
+    }
+
+    bool decompress(const unsigned char* data, size_t size,
+                    unsigned char* out, size_t out_size, EntropyWorkspace*) const override
+    {
+        if(size != out_size)
+            return false;
+        memcpy(out, data, size);
+        return true;
+    }
+};
+
+} // namespace
+
+EntropyWorkspace::EntropyWorkspace()
+    : coder_state_(nullptr)
+{
+    // deflate holds 5 blocks at once, inflate 2
+    blocks_.reserve(8);
+}
+
+EntropyWorkspace::~EntropyWorkspace()
+{
+    // returns the blocks held by the stream before releasing all of them
+    setCoderState(nullptr);
+    for(unsigned char* block : blocks_)
+        ::operator delete(block);
+}
+
+EntropyWorkspace::EntropyWorkspace(EntropyWorkspace&& rhs)
+    : blocks_(std::move(rhs.blocks_))
+    , coder_state_(rhs.coder_state_)
+{
+    rhs.coder_state_ = nullptr;
+}
+
+EntropyWorkspace& EntropyWorkspace::operator=(EntropyWorkspace&& rhs)
+{
+    if(this != &rhs) {
+        setCoderState(nullptr);
+        for(unsigned char* block : blocks_)
+            ::operator delete(block);
+        blocks_ = std::move(rhs.blocks_);
+        coder_state_ = rhs.coder_state_;
+        rhs.coder_state_ = nullptr;
+    }
+    return *this;
+}
+
+void* EntropyWorkspace::acquire(size_t size)
+{
+    for(size_t i = 0; i < blocks_.size(); ++i) {
+        size_t block_size;
+        memcpy(&block_size, blocks_[i], sizeof(size_t));
+        if(block_size != size)
+            continue;
+        unsigned char* block = blocks_[i];
+        blocks_[i] = blocks_.back();
+        blocks_.pop_back();
+        return block + BLOCK_HEADER_SIZE;
+    }
+    auto block = static_cast<unsigned char*>(::operator new(BLOCK_HEADER_SIZE + size, std::nothrow));
+    if(block == nullptr)
+        return nullptr;
+    memcpy(block, &size, sizeof(size_t));
+    return block + BLOCK_HEADER_SIZE;
+}
+
+void EntropyWorkspace::release(void* ptr)
+{
+    blocks_.push_back(static_cast<unsigned char*>(ptr) - BLOCK_HEADER_SIZE);
+}
+
+EntropyWorkspace::CoderState* EntropyWorkspace::getCoderState() const
+{
+    return coder_state_;
+}
+
+void EntropyWorkspace::setCoderState(CoderState* state)
+{
+    if(coder_state_ != nullptr) {
+        coder_state_->close(*this);
+        delete coder_state_;
+    }
+    coder_state_ = state;
+}
+
+const EntropyCoder* findEntropyCoder(EntropyBackend backend)
+{
+    static const ZlibCoder zlib_coder;
+    static const LzCoder lz_coder;
+    static const StoreCoder store_coder;
+    switch(backend) {
+    case ENTROPY_ZLIB:
+        return &zlib_coder;
+    case ENTROPY_LZ:
+        return &lz_coder;
+    case ENTROPY_STORE:
+        return &store_coder;
+    default:
+        return nullptr;
+    }
+}
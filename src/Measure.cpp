@@ -1,4 +1,5 @@
 #include "Measure.hpp"
+#include "ThreadPool.hpp"
 
 Measure::Measure()
   : start_time_()
@@ -51,10 +52,9 @@ const Measure::ComparisonResult Measure::compare(std::vector<UncompressedVoxel>
     std::vector<float> min_distances(p1.size());
     std::vector<float> color_errors(p1.size());
 
-#pragma omp parallel for
-    for(size_t p1_idx = 0; p1_idx < p1.size(); ++p1_idx) {
+    ThreadPool::getDefault().parallelFor(0, p1.size(), 0, [&](size_t p1_idx) {
         if(!bb.contains(p1[p1_idx].pos))
-            continue;
+            return;
         float closest_distance = 100000;
         float clr_error = 0;
         for(auto p2_voxel : p2) {
@@ -74,7 +74,7 @@ const Measure::ComparisonResult Measure::compare(std::vector<UncompressedVoxel>
         }
         min_distances[p1_idx] = closest_distance;
         color_errors[p1_idx] = clr_error;
-    }
+    });
 
     float max_pos_error = 0;
     float avg_pos_error = 0;
@@ -0,0 +1,260 @@
+#include "OctreeCoder.hpp"
+#include "Varint.hpp"
+
+#include <algorithm>
+
+namespace {
+
+/**
+ * Returns true if the most significant bit of a is lower than the one of b.
+*/
+bool lessMsb(uint64_t a, uint64_t b)
+{
+    return a < b && a < (a ^ b);
+}
+
+/**
+ * Compares positions in octree order.
+ * The axis with the most significant differing bit decides,
+ * z before y before x for differences on the same level.
+*/
+bool octreeLess(const Vec<uint64_t>& a, const Vec<uint64_t>& b)
+{
+    uint64_t diff = a.z ^ b.z;
+    uint64_t lhs = a.z, rhs = b.z;
+    if(lessMsb(diff, a.y ^ b.y)) {
+        diff = a.y ^ b.y;
+        lhs = a.y;
+        rhs = b.y;
+    }
+    if(lessMsb(diff, a.x ^ b.x)) {
+        lhs = a.x;
+        rhs = b.x;
+    }
+    return lhs < rhs;
+}
+
+unsigned calcChildIndex(const Vec<uint64_t>& pos, unsigned shift)
+{
+    return static_cast<unsigned>(((pos.x >> shift) & 1) |
+                                 (((pos.y >> shift) & 1) << 1) |
+                                 (((pos.z >> shift) & 1) << 2));
+}
+
+unsigned calcBitLength(uint64_t value)
+{
+    unsigned length = 0;
+    for(; value != 0; value >>= 1)
+        ++length;
+    return length;
+}
+
+/**
+ * Fills order with the indexes of given positions in octree order,
+ * points of equal position keep their relative order.
+*/
+void calcOctreeOrder(const std::vector<Vec<uint64_t>>& pos, std::vector<unsigned>& order)
+{
+    order.resize(pos.size());
+    for(unsigned i = 0; i < order.size(); ++i)
+        order[i] = i;
+    // ties are broken by index instead of std::stable_sort, which allocates a buffer
+    std::sort(order.begin(), order.end(), [&pos](unsigned a, unsigned b) {
+        if(octreeLess(pos[a], pos[b]))
+            return true;
+        return !octreeLess(pos[b], pos[a]) && a < b;
+    });
+}
+
+/**
+ * Largest number of levels considered for ordering nodes within a level of detail,
+ * such that the reversed child index sequence fits 64 bits.
+*/
+const unsigned MAX_LOD_KEY_LEVELS = 21;
+
+} // namespace
+
+unsigned calcOctreeDepth(BitCount nx, BitCount ny, BitCount nz)
+{
+    return std::max(static_cast<unsigned>(nx), std::max(static_cast<unsigned>(ny), static_cast<unsigned>(nz)));
+}
+
+void sortOctreeOrder(BitVecArray& points, BitVecArray& colors, OctreeScratch& scratch)
+{
+    size_t num_elmnts = points.size();
+    std::vector<Vec<uint64_t>>& pos = scratch.pos;
+    std::vector<Vec<uint64_t>>& clr = scratch.clr;
+    pos.resize(num_elmnts);
+    clr.resize(num_elmnts);
+    for(unsigned i = 0; i < num_elmnts; ++i) {
+        pos[i] = points[i];
+        clr[i] = colors[i];
+    }
+    std::vector<unsigned>& order = scratch.order;
+    calcOctreeOrder(pos, order);
+    for(unsigned i = 0; i < num_elmnts; ++i) {
+        points.set(i, pos[order[i]]);
+        colors.set(i, clr[order[i]]);
+    }
+}
+
+void sortLodOrder(BitVecArray& points, BitVecArray& colors, OctreeScratch& scratch)
+{
+    size_t num_elmnts = points.size();
+    unsigned depth = calcOctreeDepth(points.getNX(), points.getNY(), points.getNZ());
+    std::vector<Vec<uint64_t>>& pos = scratch.pos;
+    std::vector<Vec<uint64_t>>& clr = scratch.clr;
+    pos.resize(num_elmnts);
+    clr.resize(num_elmnts);
+    for(unsigned i = 0; i < num_elmnts; ++i) {
+        pos[i] = points[i];
+        clr[i] = colors[i];
+    }
+    std::vector<unsigned>& octree_order = scratch.octree_order;
+    calcOctreeOrder(pos, octree_order);
+
+    // in octree order, a point is the first of its node on all levels
+    // below the levels shared with its predecessor
+    std::vector<LodKey>& keys = scratch.lod_keys;
+    std::vector<unsigned>& order = scratch.order;
+    keys.resize(num_elmnts);
+    order.resize(num_elmnts);
+    for(unsigned rank = 0; rank < num_elmnts; ++rank) {
+        const Vec<uint64_t>& p = pos[octree_order[rank]];
+        unsigned level = 0;
+        if(rank > 0) {
+            const Vec<uint64_t>& prev = pos[octree_order[rank-1]];
+            uint64_t diff = (p.x ^ prev.x) | (p.y ^ prev.y) | (p.z ^ prev.z);
+            level = depth - calcBitLength(diff) + 1;
+        }
+        uint64_t reversed_node = 0;
+        unsigned key_levels = std::min(std::min(level, depth), MAX_LOD_KEY_LEVELS);
+        for(unsigned l = 0; l < key_levels; ++l)
+            reversed_node |= static_cast<uint64_t>(calcChildIndex(p, depth - 1 - l)) << (3*l);
+        keys[rank].level = level;
+        keys[rank].reversed_node = reversed_node;
+        keys[rank].octree_rank = rank;
+        order[rank] = rank;
+    }
+    std::sort(order.begin(), order.end(), [&keys](unsigned a, unsigned b) {
+        return keys[a] < keys[b];
+    });
+
+    for(unsigned i = 0; i < num_elmnts; ++i) {
+        points.set(i, pos[octree_order[order[i]]]);
+        colors.set(i, clr[octree_order[order[i]]]);
+    }
+}
+
+void octreeEncodeCell(const BitVecArray& points, std::vector<unsigned char>& out, OctreeScratch& scratch)
+{
+    size_t num_elmnts = points.size();
+    if(num_elmnts == 0)
+        return;
+    unsigned depth = calcOctreeDepth(points.getNX(), points.getNY(), points.getNZ());
+    std::vector<Vec<uint64_t>>& pos = scratch.pos;
+    pos.resize(num_elmnts);
+    for(unsigned i = 0; i < num_elmnts; ++i)
+        pos[i] = points[i];
+
+    // nodes of a level are contiguous ranges of points,
+    // stored by their end index
+    std::vector<size_t>& node_ends = scratch.node_ends;
+    std::vector<size_t>& child_ends = scratch.child_ends;
+    node_ends.assign(1, num_elmnts);
+    for(unsigned level = 0; level < depth; ++level) {
+        unsigned shift = depth - 1 - level;
+        child_ends.clear();
+        size_t begin = 0;
+        for(size_t end : node_ends) {
+            unsigned char occupancy = 0;
+            unsigned child = calcChildIndex(pos[begin], shift);
+            for(size_t i = begin; i < end; ++i) {
+                unsigned next_child = i + 1 < end ? calcChildIndex(pos[i+1], shift) : 8;
+                if(next_child != child) {
+                    occupancy |= static_cast<unsigned char>(1 << child);
+                    child_ends.push_back(i + 1);
+                    child = next_child;
+                }
+            }
+            out.push_back(occupancy);
+            begin = end;
+        }
+        node_ends.swap(child_ends);
+    }
+
+    // leaves hold points of equal position
+    if(node_ends.size() < num_elmnts) {
+        size_t begin = 0;
+        for(size_t end : node_ends) {
+            writeVarint(out, end - begin - 1);
+            begin = end;
+        }
+    }
+}
+
+size_t octreeDecodeCell(const unsigned char* data, size_t size, size_t num_elmnts, BitVecArray& points,
+                        OctreeScratch& scratch)
+{
+    points.clear();
+    if(num_elmnts == 0)
+        return 0;
+    unsigned depth = calcOctreeDepth(points.getNX(), points.getNY(), points.getNZ());
+
+    std::vector<Vec<uint64_t>>& nodes = scratch.nodes;
+    std::vector<Vec<uint64_t>>& children = scratch.children;
+    nodes.assign(1, Vec<uint64_t>(0, 0, 0));
+    size_t offset = 0;
+    for(unsigned level = 0; level < depth; ++level) {
+        children.clear();
+        for(const Vec<uint64_t>& node : nodes) {
+            if(offset >= size)
+                return 0;
+            unsigned char occupancy = data[offset++];
+            if(occupancy == 0)
+                return 0;
+            for(unsigned child = 0; child < 8; ++child) {
+                if((occupancy & (1 << child)) == 0)
+                    continue;
+                children.emplace_back((node.x << 1) | (child & 1),
+                                      (node.y << 1) | ((child >> 1) & 1),
+                                      (node.z << 1) | (child >> 2));
+            }
+            // every node holds at least one point
+            if(children.size() > num_elmnts)
+                return 0;
+        }
+        nodes.swap(children);
+    }
+
+    // validate counts of all leaves before allocating points
+    std::vector<uint64_t>& counts = scratch.leaf_counts;
+    counts.assign(nodes.size(), 1);
+    uint64_t total = nodes.size();
+    if(total < num_elmnts) {
+        total = 0;
+        for(uint64_t& count : counts) {
+            uint64_t additional = 0;
+            if(!readVarint(data, size, offset, additional) || additional >= num_elmnts - total)
+                return 0;
+            count += additional;
+            total += count;
+        }
+    }
+    if(total != num_elmnts)
+        return 0;
+
+    points.resize(static_cast<unsigned>(num_elmnts));
+    unsigned elmnt_idx = 0;
+    for(size_t leaf_idx = 0; leaf_idx < nodes.size(); ++leaf_idx) {
+        for(uint64_t i = 0; i < counts[leaf_idx]; ++i)
+            points.set(elmnt_idx++, nodes[leaf_idx]);
+    }
+    return offset;
+}
+
+size_t calcMaxOctreeSize(size_t num_elmnts, unsigned depth)
+{
+    // every point adds at most one node per level and a varint of up to 10 bytes
+    return num_elmnts * (depth + 10);
+}
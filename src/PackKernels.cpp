@@ -0,0 +1,134 @@
+#include "PackKernels.hpp"
+
+#if defined(__GNUC__)
+#define LIBPCC_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define LIBPCC_FORCE_INLINE inline
+#endif
+
+namespace {
+
+/**
+ * Largest component precision for which
+ * uniform (N,N,N) kernels are specialized.
+*/
+const unsigned MAX_UNIFORM_BITS = 16;
+
+template <unsigned N>
+LIBPCC_FORCE_INLINE void putBits(uint64_t* words, unsigned offset, uint64_t value)
+{
+    value &= (uint64_t(1) << N) - 1;
+    unsigned w = offset >> 6;
+    unsigned s = offset & 63;
+    words[w] |= value << s;
+    if(s + N > 64)
+        words[w+1] |= value >> (64 - s);
+}
+
+template <unsigned N>
+LIBPCC_FORCE_INLINE uint64_t getBits(const uint64_t* words, unsigned offset)
+{
+    unsigned w = offset >> 6;
+    unsigned s = offset & 63;
+    uint64_t value = words[w] >> s;
+    if(s + N > 64)
+        value |= words[w+1] << (64 - s);
+    return value & ((uint64_t(1) << N) - 1);
+}
+
+/**
+ * Packs blocks of PACK_BLOCK_SIZE elements.
+ * All bit offsets within a block are compile time constants,
+ * so the inner loops unroll into fixed shift & or sequences.
+*/
+template <unsigned NX, unsigned NY, unsigned NZ>
+void packBlocks(const uint16_t* x, const uint16_t* y, const uint16_t* z,
+                size_t num_blocks, unsigned char* out)
+{
+    const unsigned E = NX+NY+NZ;
+    const unsigned W = (E+7)/8;
+    for(size_t b = 0; b < num_blocks; ++b) {
+        uint64_t words[W] = {};
+        size_t first = b*PACK_BLOCK_SIZE;
+        for(unsigned k = 0; k < PACK_BLOCK_SIZE; ++k) {
+            putBits<NX>(words, k*E, x[first+k]);
+            putBits<NY>(words, k*E+NX, y[first+k]);
+            putBits<NZ>(words, k*E+NX+NY, z[first+k]);
+        }
+        unsigned char* o = out + b*E;
+        for(unsigned i = 0; i < E; ++i)
+            o[i] = static_cast<unsigned char>(words[i >> 3] >> (8*(i & 7)));
+    }
+}
+
+/**
+ * Unpacks blocks of PACK_BLOCK_SIZE elements.
+*/
+template <unsigned NX, unsigned NY, unsigned NZ>
+void unpackBlocks(const unsigned char* in, size_t num_blocks,
+                  uint16_t* x, uint16_t* y, uint16_t* z)
+{
+    const unsigned E = NX+NY+NZ;
+    const unsigned W = (E+7)/8;
+    for(size_t b = 0; b < num_blocks; ++b) {
+        uint64_t words[W] = {};
+        const unsigned char* i_ptr = in + b*E;
+        for(unsigned i = 0; i < E; ++i)
+            words[i >> 3] |= static_cast<uint64_t>(i_ptr[i]) << (8*(i & 7));
+        size_t first = b*PACK_BLOCK_SIZE;
+        for(unsigned k = 0; k < PACK_BLOCK_SIZE; ++k) {
+            x[first+k] = static_cast<uint16_t>(getBits<NX>(words, k*E));
+            y[first+k] = static_cast<uint16_t>(getBits<NY>(words, k*E+NX));
+            z[first+k] = static_cast<uint16_t>(getBits<NZ>(words, k*E+NX+NY));
+        }
+    }
+}
+
+template <unsigned NX, unsigned NY, unsigned NZ>
+PackKernels makeKernels()
+{
+    PackKernels k;
+    k.pack = &packBlocks<NX,NY,NZ>;
+    k.unpack = &unpackBlocks<NX,NY,NZ>;
+    return k;
+}
+
+/**
+ * Fills table[1,N] with kernels for uniform (n,n,n) precisions.
+*/
+template <unsigned N>
+struct UniformKernelTable {
+    static void fill(PackKernels* table)
+    {
+        table[N] = makeKernels<N,N,N>();
+        UniformKernelTable<N-1>::fill(table);
+    }
+};
+
+template <>
+struct UniformKernelTable<0> {
+    static void fill(PackKernels* table)
+    {
+        table[0].pack = nullptr;
+        table[0].unpack = nullptr;
+    }
+};
+
+struct KernelTable {
+    KernelTable()
+    {
+        UniformKernelTable<MAX_UNIFORM_BITS>::fill(uniform);
+    }
+
+    PackKernels uniform[MAX_UNIFORM_BITS+1];
+};
+
+} // namespace
+
+const PackKernels* findPackKernels(BitCount nx, BitCount ny, BitCount nz)
+{
+    static const KernelTable table;
+    if(nx != ny || ny != nz || static_cast<unsigned>(nx) > MAX_UNIFORM_BITS)
+        return nullptr;
+    return &table.uniform[nx];
+}
@@ -1,76 +1,798 @@
 #include "PointCloudGridEncoder.hpp"
 
-#include <set>
-#include <omp.h>
-#include <regex>
+#include <algorithm>
+#include <atomic>
 
-#include "zlib.h"
+#include "ByteStream.hpp"
 #include "Measure.hpp"
+#include "RadixSort.hpp"
+#include "RangeCoder.hpp"
+#include "Varint.hpp"
 
 void removeTailingWhitespaces(std::string& str)
 {
-    str = std::regex_replace(str, std::regex(" +$"), "");
+    // erases all of str if it only holds spaces
+    str.erase(str.find_last_not_of(' ') + 1);
 }
 
-PointCloudGridEncoder::PointCloudGridEncoder(const EncodingSettings& s)
-    : Encoder()
-    , settings(s)
-    , pc_grid_()
+/**
+ * Concatenates quantized position components as [z|y|x] bitstring.
+ * If the concatenation exceeds code_bits, least significant bits are dropped,
+ * such that codes of equal precision still compare in (z,y,x) order.
+*/
+uint64_t calcPositionCode(const Vec<uint64_t>& pos, const Vec<BitCount>& precision, unsigned code_bits)
+{
+    unsigned nx = precision.x, ny = precision.y, nz = precision.z;
+    if(nx + ny + nz <= code_bits)
+        return (pos.z << (nx + ny)) | (pos.y << nx) | pos.x;
+    unsigned drop = nx + ny + nz - code_bits;
+    if(drop >= nx + ny)
+        return pos.z >> (drop - nx - ny);
+    if(drop >= nx)
+        return (pos.z << (nx + ny - drop)) | (pos.y >> (drop - nx));
+    return (pos.z << (nx + ny - drop)) | (pos.y << (nx - drop)) | (pos.x >> drop);
+}
+
+/**
+ * Minimum number of uncompressed bytes per independently deflated chunk.
+*/
+const size_t MIN_ENTROPY_CHUNK_SIZE = 1 << 16;
+
+unsigned getMaxEntropyChunks(unsigned num_threads)
+{
+    return std::max(num_threads, 1u);
+}
+
+size_t calcChunkTableSize(unsigned num_chunks)
+{
+    return sizeof(unsigned) + num_chunks * 2 * sizeof(unsigned);
+}
+
+/**
+ * Splits [0,size) into at most max_chunks chunks of similar size.
+ * Chunks end at given split_offsets only
+ * and hold at least MIN_ENTROPY_CHUNK_SIZE bytes (except for the last one).
+ * bounds receives chunk boundaries, starting at 0 and ending at size.
+*/
+void selectEntropyChunks(const std::vector<size_t>& split_offsets, size_t size, unsigned max_chunks,
+                         std::vector<size_t>& bounds)
+{
+    size_t num_chunks = std::min<size_t>(max_chunks, std::max<size_t>(size / MIN_ENTROPY_CHUNK_SIZE, 1));
+    size_t target_size = (size + num_chunks - 1) / num_chunks;
+    bounds.assign(1, 0);
+    for(size_t split : split_offsets) {
+        if(bounds.size() == num_chunks)
+            break;
+        if(split < size && split - bounds.back() >= target_size)
+            bounds.push_back(split);
+    }
+    bounds.push_back(size);
+}
+
+/**
+ * Returns the number of blocks points are split into for counting them per cell.
+ * Blocks hold at least as many points as there are cells,
+ * such that histograms take no more memory and time than the points themselves.
+*/
+size_t calcNumHistogramBlocks(size_t num_points, size_t num_cells, unsigned num_threads)
+{
+    size_t num_blocks = std::min<size_t>(num_threads, num_points / std::max<size_t>(num_cells, 1));
+    return std::max<size_t>(num_blocks, 1);
+}
+
+bool sameBoundingBox(const BoundingBox& a, const BoundingBox& b)
+{
+    return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+           a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+template <typename C>
+bool similarComponents(const std::vector<C>& a, const std::vector<C>& b, unsigned tolerance)
+{
+    if(tolerance == 0)
+        return a == b;
+    for(size_t i = 0; i < a.size(); ++i) {
+        C diff = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        if(diff > tolerance)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Returns true if a and b share precision & number of elements
+ * and no component of corresponding elements differs by more than tolerance.
+*/
+bool similarArrays(const BitVecArray& a, const BitVecArray& b, unsigned tolerance)
+{
+    if(a.getNX() != b.getNX() || a.getNY() != b.getNY() || a.getNZ() != b.getNZ() ||
+       a.size() != b.size() || a.isWide() != b.isWide())
+        return false;
+    if(a.isWide())
+        return similarComponents(a.getWide().x, b.getWide().x, tolerance) &&
+               similarComponents(a.getWide().y, b.getWide().y, tolerance) &&
+               similarComponents(a.getWide().z, b.getWide().z, tolerance);
+    return similarComponents(a.getNarrow().x, b.getNarrow().x, tolerance) &&
+           similarComponents(a.getNarrow().y, b.getNarrow().y, tolerance) &&
+           similarComponents(a.getNarrow().z, b.getNarrow().z, tolerance);
+}
+
+uint64_t mixHash(uint64_t h, uint64_t v)
+{
+    h ^= v * 0x9E3779B97F4A7C15ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0xC2B2AE3D27D4EB4FULL;
+}
+
+/**
+ * Fast non-cryptographic 64 bit hash of size bytes at data, processed word wise.
+*/
+uint64_t hashBytes(const void* data, size_t size, uint64_t h)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = mixHash(h, word);
+    }
+    uint64_t tail = 0;
+    if(i < size)
+        memcpy(&tail, bytes + i, size - i);
+    return mixHash(h, tail ^ size);
+}
+
+template <typename C>
+uint64_t hashComponents(const ComponentArrays<C>& arr, uint64_t h)
+{
+    h = hashBytes(arr.x.data(), arr.x.size() * sizeof(C), h);
+    h = hashBytes(arr.y.data(), arr.y.size() * sizeof(C), h);
+    return hashBytes(arr.z.data(), arr.z.size() * sizeof(C), h);
+}
+
+/**
+ * Hashes precision, size & elements of given BitVecArray.
+ * Different arrays may collide, equal hashes only make equal data likely.
+*/
+uint64_t hashArray(const BitVecArray& arr, uint64_t h)
+{
+    h = mixHash(h, arr.getNX() | (arr.getNY() << 8) | (arr.getNZ() << 16) | (uint64_t(arr.size()) << 24));
+    if(arr.isWide())
+        return hashComponents(arr.getWide(), h);
+    return hashComponents(arr.getNarrow(), h);
+}
+
+/**
+ * Reduces given cell to num_points elements taken at a uniform stride.
+*/
+void subsampleCell(GridCell* cell, unsigned num_points)
+{
+    unsigned num_elmnts = cell->size();
+    if(num_points >= num_elmnts)
+        return;
+    for(unsigned i = 0; i < num_points; ++i) {
+        auto src = static_cast<unsigned>(uint64_t(i) * num_elmnts / num_points);
+        cell->points.set(i, cell->points[src]);
+        cell->colors.set(i, cell->colors[src]);
+    }
+    cell->points.resize(num_points);
+    cell->colors.resize(num_points);
+}
+
+/**
+ * Number of bytes holding the 6 precisions of a packed CellHeader, 5 bits each.
+*/
+const unsigned PACKED_PRECISION_SIZE = 4;
+
+/**
+ * First bytes of every encoded message, "LPCC" in memory.
+ * FORMAT_VERSION_LEGACY messages start with their entropy coding flag instead.
+*/
+const uint32_t MESSAGE_MAGIC = 0x4343504C;
+
+/**
+ * Feature flags of the GlobalHeader.
+ * Decoders reject messages using flags unknown to them.
+*/
+enum FeatureFlag : uint32_t {
+    FEATURE_ENTROPY_CODING = 1 << 0, // payload after GlobalHeader is entropy encoded
+    FEATURE_PROGRESSIVE = 1 << 1     // points of every cell are in level of detail order
+};
+
+const uint32_t KNOWN_FEATURES = FEATURE_ENTROPY_CODING | FEATURE_PROGRESSIVE;
+
+/**
+ * Identifies how the blacklist is stored in the message.
+*/
+enum BlackListCoding : uint8_t {
+    BLACKLIST_BITMAP = 0, // one bit per cell
+    BLACKLIST_RUNS = 1    // alternating run lengths of white & black cells as varints
+};
+
+/**
+ * Returns the number of bytes of the run length encoding of given cell flags.
+ * Runs alternate between cells not flagged and flagged, starting with a (possibly empty) unflagged run.
+*/
+size_t calcRunLengthSize(const std::vector<unsigned char>& flags)
+{
+    size_t size = 0;
+    unsigned char current = 0;
+    uint64_t run = 0;
+    for(unsigned char flag : flags) {
+        if((flag != 0) != (current != 0)) {
+            size += calcVarintSize(run);
+            current = flag != 0;
+            run = 0;
+        }
+        ++run;
+    }
+    return size + calcVarintSize(run);
+}
+
+size_t calcBitmapSize(size_t num_cells)
+{
+    return (num_cells + 7) / 8;
+}
+
+/**
+ * Returns the number of bytes used by encodeBlackList for given blacklist flags.
+*/
+size_t calcBlackListSize(const std::vector<unsigned char>& black_cells)
+{
+    return sizeof(BlackListCoding) + std::min(calcBitmapSize(black_cells.size()), calcRunLengthSize(black_cells));
+}
+
+void freeMessageBuffer(void* data, void*)
+{
+    free(data);
+}
+
+/**
+ * OutputSink handing its reserved buffer over to a zmq::message_t.
+*/
+class MessageSink : public OutputSink {
+public:
+    MessageSink()
+        : data_(nullptr)
+        , size_(0)
+    {}
+
+    ~MessageSink() override
+    {
+        free(data_);
+    }
+
+    unsigned char* reserve(size_t max_size) override
+    {
+        free(data_);
+        data_ = (unsigned char*) malloc(max_size);
+        return data_;
+    }
+
+    void commit(size_t size) override
+    {
+        size_ = size;
+    }
+
+    /**
+     * Transfers ownership of the committed message into a zmq::message_t.
+    */
+    zmq::message_t release()
+    {
+        if(data_ == nullptr)
+            return zmq::message_t();
+        zmq::message_t msg(data_, size_, freeMessageBuffer, nullptr);
+        data_ = nullptr;
+        return msg;
+    }
+
+private:
+    unsigned char* data_;
+    size_t size_;
+};
+
+PointCloudGridEncoder::Context::Context()
+    : encode_log()
+    , decode_log()
+    , pc_grid_(new PointCloudGrid(Vec8(1,1,1)))
     , header_()
     , global_header_()
+    , ref_grid_(new PointCloudGrid(Vec8(1,1,1)))
+    , ref_grid_valid_(false)
+    , next_frame_idx_(0)
+    , frames_since_keyframe_(0)
+    , cache_grid_(new PointCloudGrid(Vec8(1,1,1)))
+    , cache_range_coded_(false)
+    , cache_octree_coded_(false)
+    , decoded_frame_valid_(false)
+    , decoded_frame_idx_(0)
+{}
+
+PointCloudGridEncoder::Context::~Context()
+{
+    delete pc_grid_;
+    delete ref_grid_;
+    delete cache_grid_;
+}
+
+const PointCloudGrid* PointCloudGridEncoder::Context::getPointCloudGrid() const
+{
+    return pc_grid_;
+}
+
+void PointCloudGridEncoder::Context::requestKeyframe()
 {
-    pc_grid_ = new PointCloudGrid(Vec8(1,1,1));
-    header_ = new GridHeader;
-    global_header_ = new GlobalHeader;
+    ref_grid_valid_ = false;
 }
 
+PointCloudGridEncoder::PointCloudGridEncoder(const EncodingSettings& s)
+    : Encoder()
+    , settings(s)
+    , encode_log()
+    , decode_log()
+    , thread_pool_(&ThreadPool::getDefault())
+    , max_loop_threads_(0)
+{}
+
 PointCloudGridEncoder::~PointCloudGridEncoder()
 {
-    delete pc_grid_;
-    delete header_;
-    delete global_header_;
+    // finish asynchronous calls before releasing the state they use
+    executor_.reset();
+    decode_executor_.reset();
+    for(Context* ctx : batch_contexts_)
+        delete ctx;
 }
 
 zmq::message_t PointCloudGridEncoder::encode(const std::vector<UncompressedVoxel>& point_cloud, int num_points)
 {
-    // set properties for parallelization
-    omp_set_num_threads(settings.num_threads);
-    // Set properties for new grid
-    pc_grid_->resize(settings.grid_precision.dimensions);
-    pc_grid_->bounding_box = settings.grid_precision.bounding_box;
-    buildPointCloudGrid(point_cloud, num_points);
+    MessageSink sink;
+    encode(point_cloud, sink, num_points);
+    return sink.release();
+}
+
+size_t PointCloudGridEncoder::encode(const std::vector<UncompressedVoxel>& point_cloud, OutputSink& sink,
+                                     int num_points)
+{
+    size_t msg_size = encode(point_cloud, sink, context_, num_points);
+    encode_log = context_.encode_log;
+    return msg_size;
+}
+
+zmq::message_t PointCloudGridEncoder::encode(const std::vector<UncompressedVoxel>& point_cloud, Context& ctx,
+                                             int num_points) const
+{
+    MessageSink sink;
+    encode(point_cloud, sink, ctx, num_points);
+    return sink.release();
+}
+
+size_t PointCloudGridEncoder::encode(const std::vector<UncompressedVoxel>& point_cloud, OutputSink& sink, Context& ctx,
+                                     int num_points) const
+{
+    return encodeCloud(ctx, point_cloud, num_points, settings.grid_precision, sink);
+}
+
+bool PointCloudGridEncoder::encodeBatch(const std::vector<BatchCloud>& clouds, std::vector<zmq::message_t>& messages)
+{
+    while(batch_contexts_.size() < clouds.size())
+        batch_contexts_.push_back(new Context);
+    return encodeBatch(clouds, messages, batch_contexts_);
+}
+
+bool PointCloudGridEncoder::encodeBatch(const std::vector<BatchCloud>& clouds, std::vector<zmq::message_t>& messages,
+                                        const std::vector<Context*>& contexts) const
+{
+    if(contexts.size() < clouds.size()) {
+        std::cout << "NOTIFICATION: encodeBatch got " << contexts.size() << " contexts for "
+                  << clouds.size() << " clouds." << std::endl;
+        return false;
+    }
+    messages.resize(clouds.size());
+    std::atomic<bool> success(true);
+    // small clouds leave the workers of their own loops idle,
+    // which then help encoding other clouds
+    parallelFor(0, clouds.size(), [&](size_t i) {
+        const BatchCloud& cloud = clouds[i];
+        MessageSink sink;
+        if(cloud.point_cloud != nullptr) {
+            const GridPrecisionDescriptor* precision = cloud.grid_precision;
+            encodeCloud(*contexts[i], *cloud.point_cloud, cloud.num_points,
+                        precision != nullptr ? *precision : settings.grid_precision, sink);
+        }
+        messages[i] = sink.release();
+        if(messages[i].size() == 0)
+            success = false;
+    }, 1);
+    return success;
+}
+
+size_t PointCloudGridEncoder::encodeCloud(Context& ctx, const std::vector<UncompressedVoxel>& point_cloud,
+                                          int num_points, const GridPrecisionDescriptor& precision,
+                                          OutputSink& sink) const
+{
+    // overwrites the frame a subsequent delta frame would be decoded onto
+    ctx.decoded_frame_valid_ = false;
+    buildPointCloudGrid(ctx, point_cloud, num_points, precision);
+
+    const EntropyCoder* coder = nullptr;
+    if(!prepareGridMessage(ctx, &coder))
+        return 0;
+
+    // reserve upper bound of message size in sink
+    size_t grid_size = calcGridMessageSize(ctx);
+    size_t max_size = calcMessageCapacity(coder, grid_size);
+    unsigned char* out = sink.reserve(max_size);
+    if(out == nullptr) {
+        std::cout << "NOTIFICATION: OutputSink could not reserve " << max_size << " bytes." << std::endl;
+        // frame is lost, so the next one must not refer to it,
+        // cell hashes might refer to data not packed
+        ctx.requestKeyframe();
+        ctx.cell_hashes_.clear();
+        return 0;
+    }
 
-    if(settings.entropy_coding) {
-      return entropyCompression(encodePointCloudGrid());
+    // encode grid directly behind GlobalHeader,
+    // or compress it into this region from intermediate grid buffer
+    size_t offset = GlobalHeader::getByteSize(settings.format_version);
+    size_t payload_size = 0;
+    if(coder != nullptr) {
+        ctx.grid_buffer_.resize(grid_size);
+        encodePointCloudGrid(ctx, ctx.grid_buffer_.data());
+        payload_size = entropyCompression(ctx, coder, ctx.grid_buffer_.data(), grid_size, ctx.arena_.cell_offsets,
+                                          out + offset);
+        // frame is lost, cell caches stay valid as the grid has been packed
+        if(payload_size == 0) {
+            ctx.requestKeyframe();
+            return 0;
+        }
     } else {
-      return finalizeMessage(encodePointCloudGrid());
+        payload_size = encodePointCloudGrid(ctx, out + offset);
     }
-};
+    size_t msg_size = finishMessage(ctx, out, grid_size, payload_size);
+
+    updateReferenceGrid(ctx);
+
+    sink.commit(msg_size);
+    return msg_size;
+}
+
+bool PointCloudGridEncoder::prepareGridMessage(Context& ctx, const EntropyCoder** coder) const
+{
+    *coder = nullptr;
+    if(settings.format_version == FORMAT_VERSION_LEGACY) {
+        std::cout << "NOTIFICATION: legacy format version can only be decoded." << std::endl;
+        return false;
+    }
+    if(settings.format_version > FORMAT_VERSION_CURRENT) {
+        std::cout << "NOTIFICATION: unknown format version " << (int) settings.format_version << "." << std::endl;
+        return false;
+    }
+    ctx.global_header_.format_version = settings.format_version;
+    ctx.global_header_.entropy_coding = settings.entropy_coding;
+    ctx.global_header_.entropy_backend = settings.entropy_backend;
+    ctx.global_header_.appendix_size = settings.appendix_size;
+    ctx.global_header_.geometry_coding = isRangeCoded(ctx) ? GEOMETRY_PACKED : settings.geometry_coding;
+    ctx.global_header_.progressive = settings.progressive_ordering && !isOctreeCoded(ctx);
+
+    // points of octree coded cells are stored in octree order,
+    // points of progressive cells in level of detail order
+    if(isOctreeCoded(ctx)) {
+        parallelForScratch(ctx, ctx.pc_grid_->cells.size(), [&ctx](size_t cell_idx, OctreeScratch& scratch) {
+            GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+            sortOctreeOrder(cell->points, cell->colors, scratch);
+        });
+    }
+    else if(ctx.global_header_.progressive) {
+        parallelForScratch(ctx, ctx.pc_grid_->cells.size(), [&ctx](size_t cell_idx, OctreeScratch& scratch) {
+            GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+            sortLodOrder(cell->points, cell->colors, scratch);
+        });
+    }
+
+    // range coded cells replace byte level entropy coding
+    if(settings.entropy_coding && !isRangeCoded(ctx)) {
+        *coder = findEntropyCoder(settings.entropy_backend);
+        if(*coder == nullptr) {
+            std::cout << "NOTIFICATION: unknown entropy backend " << (int) settings.entropy_backend << "." << std::endl;
+            return false;
+        }
+    }
+    selectSkippedCells(ctx);
+    hashCells(ctx);
+    if(hasPrecodedCells(ctx))
+        precodeCells(ctx);
+    return true;
+}
+
+size_t PointCloudGridEncoder::calcMessageCapacity(const EntropyCoder* coder, size_t grid_size) const
+{
+    size_t max_payload_size = coder != nullptr ? calcMaxEntropySize(coder, grid_size) : grid_size;
+    return GlobalHeader::getByteSize(settings.format_version) + max_payload_size + settings.appendix_size;
+}
+
+size_t PointCloudGridEncoder::finishMessage(Context& ctx, unsigned char* out, size_t grid_size,
+                                            size_t payload_size) const
+{
+    ctx.global_header_.uncompressed_size = grid_size;
+    size_t offset = encodeGlobalHeader(ctx.global_header_, out) + payload_size;
+    memset(out + offset, ' ', settings.appendix_size);
+    return offset + settings.appendix_size;
+}
+
+zmq::message_t PointCloudGridEncoder::encodeGridMessage(Context& ctx, const GlobalHeader& header,
+                                                        const EntropyCoder* coder,
+                                                        const unsigned char* grid, size_t grid_size,
+                                                        const std::vector<size_t>& split_offsets) const
+{
+    ctx.global_header_ = header;
+    MessageSink sink;
+    size_t max_size = calcMessageCapacity(coder, grid_size);
+    unsigned char* out = sink.reserve(max_size);
+    if(out == nullptr) {
+        std::cout << "NOTIFICATION: could not allocate " << max_size << " bytes for message." << std::endl;
+        return zmq::message_t();
+    }
+    size_t offset = GlobalHeader::getByteSize(header.format_version);
+    size_t payload_size = grid_size;
+    if(coder != nullptr) {
+        payload_size = entropyCompression(ctx, coder, grid, grid_size, split_offsets, out + offset);
+        if(payload_size == 0)
+            return zmq::message_t();
+    } else {
+        memcpy(out + offset, grid, grid_size);
+    }
+    sink.commit(finishMessage(ctx, out, grid_size, payload_size));
+    return sink.release();
+}
+
+size_t PointCloudGridEncoder::encodeInto(const std::vector<UncompressedVoxel>& point_cloud, unsigned char* out,
+                                         size_t capacity, int num_points)
+{
+    BufferSink sink(out, capacity);
+    return encode(point_cloud, sink, num_points);
+}
+
+size_t PointCloudGridEncoder::calcMaxMessageSize(size_t num_points) const
+{
+    const GridPrecisionDescriptor& precision = settings.grid_precision;
+    size_t num_cells = precision.dimensions.x * precision.dimensions.y * precision.dimensions.z;
+    bool range_coding = settings.entropy_coding && settings.entropy_backend == ENTROPY_RANGE;
+    bool octree_coding = !range_coding && settings.geometry_coding == GEOMETRY_OCTREE;
+    // largest number of bits used by one point in any cell
+    size_t max_point_bits = 0;
+    size_t max_color_bits = 0;
+    unsigned max_depth = 0;
+    for(size_t cell_idx = 0; cell_idx < num_cells; ++cell_idx) {
+        const Vec<BitCount>& M_P = precision.point_precision[cell_idx];
+        const Vec<BitCount>& M_C = precision.color_precision[cell_idx];
+        size_t point_bits = M_P.x + M_P.y + M_P.z + M_C.x + M_C.y + M_C.z;
+        max_point_bits = std::max(max_point_bits, point_bits);
+        max_color_bits = std::max(max_color_bits, static_cast<size_t>(M_C.x + M_C.y + M_C.z));
+        max_depth = std::max(max_depth, calcOctreeDepth(M_P.x, M_P.y, M_P.z));
+    }
+    // every cell is either blacklisted or skipped (each covered by the size of a skip list entry)
+    // or contributes a header and two padded arrays (or a size prefix & range/octree coded data)
+    size_t grid_size = GridHeader::getByteSize() + sizeof(BlackListCoding) + calcBitmapSize(num_cells);
+    if(range_coding) {
+        grid_size += num_cells * (CellHeader::getByteSize() + sizeof(unsigned) + calcMaxRangeCodedSize(0, 0));
+        grid_size += calcMaxRangeCodedSize(num_points, max_point_bits);
+    } else if(octree_coding) {
+        grid_size += num_cells * (CellHeader::getByteSize() + sizeof(unsigned) + 1);
+        grid_size += calcMaxOctreeSize(num_points, max_depth) + (num_points * max_color_bits + 7) / 8;
+    } else {
+        grid_size += num_cells * std::max(sizeof(unsigned), CellHeader::getByteSize() + 2);
+        grid_size += (num_points * max_point_bits + 7) / 8;
+    }
+    if(settings.cell_offset_table)
+        grid_size += num_cells * sizeof(unsigned);
+    const EntropyCoder* coder = settings.entropy_coding ? findEntropyCoder(settings.entropy_backend) : nullptr;
+    size_t payload_size = coder != nullptr ? calcMaxEntropySize(coder, grid_size) : grid_size;
+    return GlobalHeader::getByteSize(settings.format_version) + payload_size + settings.appendix_size;
+}
+
+void PointCloudGridEncoder::requestKeyframe()
+{
+    context_.requestKeyframe();
+}
+
+bool PointCloudGridEncoder::decode(zmq::message_t &msg, std::vector<UncompressedVoxel>* point_cloud,
+                                   size_t max_points)
+{
+    return decode((const unsigned char*) msg.data(), msg.size(), point_cloud, max_points);
+}
+
+bool PointCloudGridEncoder::decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                                   size_t max_points)
+{
+    bool success = decode(data, size, point_cloud, context_, max_points);
+    decode_log = context_.decode_log;
+    return success;
+}
+
+bool PointCloudGridEncoder::decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud,
+                                   const BoundingBox& roi, size_t max_points)
+{
+    return decode((const unsigned char*) msg.data(), msg.size(), point_cloud, Frustum(roi), max_points);
+}
+
+bool PointCloudGridEncoder::decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                                   const BoundingBox& roi, size_t max_points)
+{
+    return decode(data, size, point_cloud, Frustum(roi), max_points);
+}
+
+bool PointCloudGridEncoder::decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud,
+                                   const Frustum& frustum, size_t max_points)
+{
+    return decode((const unsigned char*) msg.data(), msg.size(), point_cloud, frustum, max_points);
+}
+
+bool PointCloudGridEncoder::decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                                   const Frustum& frustum, size_t max_points)
+{
+    bool success = decode(data, size, point_cloud, context_, frustum, max_points);
+    decode_log = context_.decode_log;
+    return success;
+}
 
-bool PointCloudGridEncoder::decode(zmq::message_t &msg, std::vector<UncompressedVoxel>* point_cloud)
+bool PointCloudGridEncoder::decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, Context& ctx,
+                                   size_t max_points) const
 {
-    // set properties for parallelization
-    omp_set_num_threads(settings.num_threads);
-    if(!decodePointCloudGrid(msg))
+    return decode((const unsigned char*) msg.data(), msg.size(), point_cloud, ctx, max_points);
+}
+
+bool PointCloudGridEncoder::decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                                   Context& ctx, size_t max_points) const
+{
+    if(!decodePointCloudGrid(ctx, data, size, max_points))
         return false;
-    return extractPointCloudFromGrid(point_cloud);
+    return extractPointCloudFromGrid(ctx, point_cloud);
+}
+
+bool PointCloudGridEncoder::decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud,
+                                   const BoundingBox& roi, Context& ctx, size_t max_points) const
+{
+    return decode((const unsigned char*) msg.data(), msg.size(), point_cloud, ctx, Frustum(roi), max_points);
+}
+
+bool PointCloudGridEncoder::decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                                   const BoundingBox& roi, Context& ctx, size_t max_points) const
+{
+    return decode(data, size, point_cloud, ctx, Frustum(roi), max_points);
+}
+
+bool PointCloudGridEncoder::decode(zmq::message_t& msg, std::vector<UncompressedVoxel>* point_cloud, Context& ctx,
+                                   const Frustum& frustum, size_t max_points) const
+{
+    return decode((const unsigned char*) msg.data(), msg.size(), point_cloud, ctx, frustum, max_points);
+}
+
+bool PointCloudGridEncoder::decode(const unsigned char* data, size_t size, std::vector<UncompressedVoxel>* point_cloud,
+                                   Context& ctx, const Frustum& frustum, size_t max_points) const
+{
+    if(!decodePointCloudGrid(ctx, data, size, max_points, &frustum))
+        return false;
+    return extractPointCloudFromGrid(ctx, point_cloud);
+}
+
+std::future<zmq::message_t> PointCloudGridEncoder::encodeAsync(std::vector<UncompressedVoxel> point_cloud,
+                                                                int num_points)
+{
+    auto promise = std::make_shared<std::promise<zmq::message_t>>();
+    // std::function requires copyable tasks, the point cloud is shared instead of copied
+    auto input = std::make_shared<std::vector<UncompressedVoxel>>(std::move(point_cloud));
+    getExecutor(executor_, executor_started_).submit([this, input, promise, num_points]() {
+        try {
+            promise->set_value(encode(*input, num_points));
+        }
+        catch(...) {
+            context_.requestKeyframe();
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return promise->get_future();
+}
+
+void PointCloudGridEncoder::encodeAsync(std::vector<UncompressedVoxel> point_cloud, EncodeCallback callback,
+                                        int num_points)
+{
+    auto input = std::make_shared<std::vector<UncompressedVoxel>>(std::move(point_cloud));
+    getExecutor(executor_, executor_started_).submit([this, input, callback, num_points]() {
+        zmq::message_t msg;
+        try {
+            msg = encode(*input, num_points);
+        }
+        catch(const std::exception& e) {
+            std::cout << "FAILURE: asynchronous encoding failed: " << e.what() << std::endl;
+            context_.requestKeyframe();
+        }
+        callback(std::move(msg));
+    });
+}
+
+std::future<PointCloudGridEncoder::DecodeResult> PointCloudGridEncoder::decodeAsync(zmq::message_t msg,
+                                                                                     size_t max_points)
+{
+    auto promise = std::make_shared<std::promise<DecodeResult>>();
+    auto input = std::make_shared<zmq::message_t>(std::move(msg));
+    getExecutor(decode_executor_, decode_executor_started_).submit([this, input, promise, max_points]() {
+        try {
+            DecodeResult result;
+            result.success = decode(*input, &result.point_cloud, decode_context_, max_points);
+            result.decode_log = decode_context_.decode_log;
+            promise->set_value(std::move(result));
+        }
+        catch(...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return promise->get_future();
+}
+
+void PointCloudGridEncoder::decodeAsync(zmq::message_t msg, DecodeCallback callback, size_t max_points)
+{
+    auto input = std::make_shared<zmq::message_t>(std::move(msg));
+    getExecutor(decode_executor_, decode_executor_started_).submit([this, input, callback, max_points]() {
+        DecodeResult result;
+        try {
+            result.success = decode(*input, &result.point_cloud, decode_context_, max_points);
+            result.decode_log = decode_context_.decode_log;
+        }
+        catch(const std::exception& e) {
+            std::cout << "FAILURE: asynchronous decoding failed: " << e.what() << std::endl;
+            result = DecodeResult();
+        }
+        callback(std::move(result));
+    });
+}
+
+SerialExecutor& PointCloudGridEncoder::getExecutor(std::unique_ptr<SerialExecutor>& executor,
+                                                   std::once_flag& started)
+{
+    std::call_once(started, [&executor]() {
+        executor.reset(new SerialExecutor);
+    });
+    return *executor;
 }
 
 const PointCloudGrid* PointCloudGridEncoder::getPointCloudGrid() const
 {
-    return pc_grid_;
+    return context_.getPointCloudGrid();
+}
+
+void PointCloudGridEncoder::setThreadPool(ThreadPool* pool)
+{
+    thread_pool_ = pool != nullptr ? pool : &ThreadPool::getDefault();
+}
+
+unsigned PointCloudGridEncoder::getNumThreads() const
+{
+    unsigned num_threads = thread_pool_->getNumThreads();
+    if(settings.num_threads > 0)
+        num_threads = std::min(num_threads, static_cast<unsigned>(settings.num_threads));
+    return num_threads;
+}
+
+unsigned PointCloudGridEncoder::getLoopThreads() const
+{
+    unsigned num_threads = getNumThreads();
+    if(max_loop_threads_ > 0)
+        num_threads = std::min(num_threads, max_loop_threads_);
+    return num_threads;
 }
 
-bool PointCloudGridEncoder::writeToAppendix(zmq::message_t& msg, unsigned char* data, unsigned long size)
+bool PointCloudGridEncoder::writeToAppendix(zmq::message_t& msg, unsigned char* data, unsigned long size) const
 {
-    decodeGlobalHeader(msg);
-    if(size > global_header_->appendix_size)
+    GlobalHeader header;
+    if(decodeGlobalHeader((const unsigned char*) msg.data(), msg.size(), header) == 0)
         return false;
-    memcpy((unsigned char*) msg.data() + msg.size() - global_header_->appendix_size, data, size);
+    if(size > header.appendix_size)
+        return false;
+    memcpy((unsigned char*) msg.data() + msg.size() - header.appendix_size, data, size);
     return true;
 }
 
-bool PointCloudGridEncoder::writeToAppendix(zmq::message_t& msg, const std::string& text) {
+bool PointCloudGridEncoder::writeToAppendix(zmq::message_t& msg, const std::string& text) const {
     auto data = new unsigned char[text.size()];
     memcpy(data, text.data(), text.size());
     bool success = writeToAppendix(msg, data, text.size());
@@ -78,23 +800,27 @@ bool PointCloudGridEncoder::writeToAppendix(zmq::message_t& msg, const std::stri
     return success;
 }
 
-unsigned long PointCloudGridEncoder::readFromAppendix(zmq::message_t& msg, unsigned char*& data)
+unsigned long PointCloudGridEncoder::readFromAppendix(zmq::message_t& msg, unsigned char*& data) const
 {
-    decodeGlobalHeader(msg);
-    if(global_header_->appendix_size > 0) {
-        data = new unsigned char[global_header_->appendix_size];
-        memcpy(data, (unsigned char *) msg.data() + msg.size() - global_header_->appendix_size,
-               global_header_->appendix_size);
+    GlobalHeader header;
+    if(decodeGlobalHeader((const unsigned char*) msg.data(), msg.size(), header) == 0)
+        return 0;
+    if(header.appendix_size > 0) {
+        data = new unsigned char[header.appendix_size];
+        memcpy(data, (unsigned char *) msg.data() + msg.size() - header.appendix_size,
+               header.appendix_size);
     }
-    return global_header_->appendix_size;
+    return header.appendix_size;
 }
 
-void PointCloudGridEncoder::readFromAppendix(zmq::message_t& msg, std::string& text)
+void PointCloudGridEncoder::readFromAppendix(zmq::message_t& msg, std::string& text) const
 {
     text = "";
-    unsigned char* data;
+    unsigned char* data = nullptr;
     unsigned long size = readFromAppendix(msg, data);
-    text.append(reinterpret_cast<const char*>(data));
+    if(size == 0)
+        return;
+    text.append(reinterpret_cast<const char*>(data), size);
     if(size < text.size())
         text = text.substr(0, size);
     removeTailingWhitespaces(text);
@@ -102,202 +828,274 @@ void PointCloudGridEncoder::readFromAppendix(zmq::message_t& msg, std::string& t
     delete [] data;
 }
 
-zmq::message_t PointCloudGridEncoder::finalizeMessage(zmq::message_t msg) {
-    global_header_->entropy_coding = false;
-    global_header_->uncompressed_size = msg.size();
-    global_header_->appendix_size = settings.appendix_size;
-
-    zmq::message_t out_msg(
-        msg.size() +
-        GlobalHeader::getByteSize() +
-        global_header_->appendix_size
-    );
-
-    size_t offset = encodeGlobalHeader(out_msg);
-
-    memcpy((unsigned char*) out_msg.data() + offset,
-     (unsigned char*) msg.data(), msg.size());
-
-    if(settings.appendix_size > 0)
-        writeToAppendix(out_msg, std::string(settings.appendix_size, ' '));
-
-    return out_msg;
-}
-
-zmq::message_t PointCloudGridEncoder::entropyCompression(zmq::message_t msg) {
+size_t PointCloudGridEncoder::entropyCompression(Context& ctx, const EntropyCoder* coder,
+                                                 const unsigned char* data, size_t size,
+                                                 const std::vector<size_t>& split_offsets, unsigned char* out) const {
     Measure t;
     t.startWatch();
-    global_header_->entropy_coding = true;
-    global_header_->uncompressed_size = msg.size();
-    global_header_->appendix_size = settings.appendix_size;
 
-    auto size_compressed = static_cast<unsigned long>(msg.size() * 1.1) + 12;
-    auto entropy_compressed = new unsigned char[size_compressed];//(unsigned char*) malloc(size_compressed);
-
-    int z_result = compress(entropy_compressed, &size_compressed, (unsigned char*) msg.data(), msg.size());
-    switch( z_result )
-    {
-    case Z_OK:
-        /*if(settings.verbose)
-            printf("***** SUCCESS! *****\n");*/
-        break;
-
-    case Z_MEM_ERROR:
-        printf("FAILURE [zlib]: out of memory.\n  > Exiting.");
-        exit(1);    // quit.
-        break;
-
-    case Z_BUF_ERROR:
-        printf("FAILURE [zlib]: output buffer wasn't large enough!\n  > Exiting.");
-        exit(1);    // quit.
-        break;
-    default: break;
-    }
-
-    zmq::message_t out_msg(
-        size_compressed +
-        GlobalHeader::getByteSize() +
-        global_header_->appendix_size
-    );
-
-    size_t offset = static_cast<int>(encodeGlobalHeader(out_msg));
-    memcpy((unsigned char*) out_msg.data() + offset, entropy_compressed, size_compressed);
-    if(settings.appendix_size > 0)
-        writeToAppendix(out_msg, std::string(settings.appendix_size, ' '));
+    std::vector<size_t>& bounds = ctx.arena_.chunk_bounds;
+    selectEntropyChunks(split_offsets, size, getMaxEntropyChunks(getNumThreads()), bounds);
+    auto num_chunks = static_cast<unsigned>(bounds.size() - 1);
+    size_t table_size = calcChunkTableSize(num_chunks);
+
+    // compress chunks in parallel into slots of maximum compressed size
+    std::vector<size_t>& slot_offsets = ctx.arena_.chunk_out_offsets;
+    slot_offsets.assign(num_chunks + 1, table_size);
+    for(unsigned i = 0; i < num_chunks; ++i)
+        slot_offsets[i+1] = slot_offsets[i] + coder->calcMaxCompressedSize(bounds[i+1] - bounds[i]);
+    std::vector<size_t>& compressed_sizes = ctx.arena_.chunk_sizes;
+    compressed_sizes.assign(num_chunks, 0);
+    std::vector<EntropyWorkspace>& workspaces = ctx.arena_.entropy_workspaces;
+    if(workspaces.size() < num_chunks)
+        workspaces.resize(num_chunks);
+    parallelFor(0, num_chunks, [&](size_t i) {
+        compressed_sizes[i] = coder->compress(data + bounds[i], bounds[i+1] - bounds[i], out + slot_offsets[i],
+                                              slot_offsets[i+1] - slot_offsets[i], settings.entropy_level,
+                                              &workspaces[i]);
+    }, 1);
+
+    for(unsigned i = 0; i < num_chunks; ++i) {
+        if(compressed_sizes[i] == 0 && bounds[i+1] > bounds[i]) {
+            std::cout << "FAILURE [entropy coding]: compression of chunk failed." << std::endl;
+            return 0;
+        }
+    }
 
-    delete [] entropy_compressed;
+    // write chunk table & close gaps between compressed chunks
+    size_t offset = 0;
+    storeU32(out + offset, num_chunks);
+    offset += sizeof(unsigned);
+    size_t size_compressed = table_size;
+    for(unsigned i = 0; i < num_chunks; ++i) {
+        storeU32(out + offset, static_cast<uint32_t>(bounds[i+1] - bounds[i]));
+        storeU32(out + offset + sizeof(unsigned), static_cast<uint32_t>(compressed_sizes[i]));
+        offset += 2*sizeof(unsigned);
+        memmove(out + size_compressed, out + slot_offsets[i], compressed_sizes[i]);
+        size_compressed += compressed_sizes[i];
+    }
 
-    encode_log.entropy_compress_time = t.stopWatch();
+    ctx.encode_log.entropy_compress_time = t.stopWatch();
 
     if(settings.verbose) {
         std::cout << "ENTROPY COMPRESSION done." << std::endl;
         std::cout << "  > took " << t.stopWatch() << "ms." << std::endl;
-        std::cout << "  > uncompressed byte size " << msg.size() << std::endl;
-        std::cout << "  > compressed byte size " << out_msg.size() << std::endl;
+        std::cout << "  > chunks " << num_chunks << std::endl;
+        std::cout << "  > uncompressed byte size " << size << std::endl;
+        std::cout << "  > compressed byte size " << size_compressed << std::endl;
     }
-    return out_msg;
+    return size_compressed;
 }
 
-zmq::message_t PointCloudGridEncoder::entropyDecompression(zmq::message_t& msg, size_t offset) {
+bool PointCloudGridEncoder::entropyDecompression(Context& ctx, const EntropyCoder* coder,
+                                                 const unsigned char* data, size_t size,
+                                                 std::vector<unsigned char>& out, size_t out_size) const {
     Measure t;
     t.startWatch();
-    unsigned long compressed_size = msg.size() - offset - global_header_->appendix_size;
-    zmq::message_t msg_uncompressed(global_header_->uncompressed_size);
-    int z_result = uncompress((unsigned char*) msg_uncompressed.data(), &global_header_->uncompressed_size, (unsigned char*)msg.data() + offset, compressed_size);
-    switch( z_result )
-    {
-    case Z_OK:
-        /*if(settings.verbose)
-            printf("***** SUCCESS! *****\n");*/
-        break;
-
-    case Z_MEM_ERROR:
-        printf("FAILURE [zlib]: out of memory.\n  > Exiting.");
-        exit(1);
 
-    case Z_BUF_ERROR:
-        printf("FAILURE [zlib]: output buffer wasn't large enough!\n  > Exiting.");
-        exit(1);
-
-    default:
-        break;
+    // read chunk table and calc chunk offsets,
+    // FORMAT_VERSION_LEGACY data is a single chunk without table
+    bool legacy = ctx.global_header_.format_version == FORMAT_VERSION_LEGACY;
+    unsigned num_chunks = 1;
+    if(!legacy) {
+        if(size < sizeof(unsigned))
+            return false;
+        num_chunks = loadU32(data);
+        if(num_chunks == 0 || num_chunks > (size - sizeof(unsigned)) / (2*sizeof(unsigned)))
+            return false;
+    }
+    std::vector<size_t>& in_offsets = ctx.arena_.chunk_in_offsets;
+    std::vector<size_t>& out_offsets = ctx.arena_.chunk_out_offsets;
+    in_offsets.assign(num_chunks + 1, legacy ? 0 : calcChunkTableSize(num_chunks));
+    out_offsets.assign(num_chunks + 1, 0);
+    bool valid = true;
+    for(unsigned i = 0; i < num_chunks; ++i) {
+        const unsigned char* chunk_sizes = data + sizeof(unsigned) + i*2*sizeof(unsigned);
+        size_t raw_size = legacy ? out_size : loadU32(chunk_sizes);
+        size_t compressed_size = legacy ? size : loadU32(chunk_sizes + sizeof(unsigned));
+        valid = valid && raw_size <= coder->calcMaxDecompressedSize(compressed_size);
+        out_offsets[i+1] = out_offsets[i] + raw_size;
+        in_offsets[i+1] = in_offsets[i] + compressed_size;
+    }
+    if(!valid || out_offsets[num_chunks] != out_size || in_offsets[num_chunks] > size) {
+        std::cout << "FAILURE [entropy coding]: invalid chunk table." << std::endl;
+        return false;
+    }
+    out.resize(out_size);
+
+    // decompress chunks in parallel
+    std::vector<EntropyWorkspace>& workspaces = ctx.arena_.entropy_workspaces;
+    if(workspaces.size() < num_chunks)
+        workspaces.resize(num_chunks);
+    std::atomic<int> num_failed(0);
+    parallelFor(0, num_chunks, [&](size_t i) {
+        if(!coder->decompress(data + in_offsets[i], in_offsets[i+1] - in_offsets[i],
+                              out.data() + out_offsets[i], out_offsets[i+1] - out_offsets[i], &workspaces[i]))
+            num_failed += 1;
+    }, 1);
+
+    if(num_failed > 0) {
+        std::cout << "FAILURE [entropy coding]: corrupted input data." << std::endl;
+        return false;
     }
 
-    decode_log.entropy_decompress_time = t.stopWatch();
+    ctx.decode_log.entropy_decompress_time = t.stopWatch();
 
     if(settings.verbose) {
         std::cout << "ENTROPY DECOMPRESSION done." << std::endl;
         std::cout << "  > took " << t.stopWatch() << "ms." << std::endl;
+        std::cout << "  > chunks " << num_chunks << std::endl;
     }
-    return msg_uncompressed;
+    return true;
 }
 
-void PointCloudGridEncoder::buildPointCloudGrid(const std::vector<UncompressedVoxel>& point_cloud, int num_points) {
+size_t PointCloudGridEncoder::calcMaxEntropySize(const EntropyCoder* coder, size_t size) const
+{
+    unsigned max_chunks = getMaxEntropyChunks(getNumThreads());
+    // every chunk adds at most one stream overhead compared to a single stream
+    return calcChunkTableSize(max_chunks) + coder->calcMaxCompressedSize(size) +
+           max_chunks * coder->calcMaxCompressedSize(0);
+}
+
+void PointCloudGridEncoder::buildPointCloudGrid(Context& ctx, const std::vector<UncompressedVoxel>& point_cloud,
+                                                int num_points, const GridPrecisionDescriptor& precision) const {
+    ctx.pc_grid_->resize(precision.dimensions);
+    ctx.pc_grid_->bounding_box = precision.bounding_box;
+
     Measure t;
     t.startWatch();
 
     // init all cells to default BitCount
-    for(unsigned cell_idx = 0; cell_idx < pc_grid_->cells.size(); ++cell_idx) {
-        Vec<BitCount> M_P = settings.grid_precision.point_precision[cell_idx];
-        Vec<BitCount> M_C = settings.grid_precision.color_precision[cell_idx];
-        pc_grid_->cells[cell_idx]->initPoints(M_P.x, M_P.y, M_P.z);
-        pc_grid_->cells[cell_idx]->initColors(M_C.x, M_C.y, M_C.z);
+    for(unsigned cell_idx = 0; cell_idx < ctx.pc_grid_->cells.size(); ++cell_idx) {
+        Vec<BitCount> M_P = precision.point_precision[cell_idx];
+        Vec<BitCount> M_C = precision.color_precision[cell_idx];
+        ctx.pc_grid_->cells[cell_idx]->initPoints(M_P.x, M_P.y, M_P.z);
+        ctx.pc_grid_->cells[cell_idx]->initColors(M_C.x, M_C.y, M_C.z);
     }
 
-    Vec<float> cell_range = pc_grid_->bounding_box.calcRange();
-    cell_range.x /= (float) pc_grid_->dimensions.x;
-    cell_range.y /= (float) pc_grid_->dimensions.y;
-    cell_range.z /= (float) pc_grid_->dimensions.z;
+    Vec<float> cell_range = ctx.pc_grid_->bounding_box.calcRange();
+    cell_range.x /= (float) ctx.pc_grid_->dimensions.x;
+    cell_range.y /= (float) ctx.pc_grid_->dimensions.y;
+    cell_range.z /= (float) ctx.pc_grid_->dimensions.z;
     BoundingBox bb_cell(Vec<float>(0.0f,0.0f,0.0f), cell_range);
     BoundingBox bb_clr(Vec<float>(0.0f,0.0f,0.0f), Vec<float>(255.0f,255.0f,255.0f));
 
-    // Create one grid per thread
-    // to avoid race conditions writing to shared grid
-    auto max_threads = static_cast<unsigned>(omp_get_max_threads());
-    unsigned num_cells = pc_grid_->dimensions.x * pc_grid_->dimensions.y * pc_grid_->dimensions.z;
-    std::vector<std::vector<size_t>> t_grid_elmts(max_threads, std::vector<size_t>(num_cells, 0));
-    std::vector<unsigned> point_cell_idx(point_cloud.size());
+    unsigned num_cells = ctx.pc_grid_->dimensions.x * ctx.pc_grid_->dimensions.y * ctx.pc_grid_->dimensions.z;
 
     if(num_points < 0)
         num_points = static_cast<int>(point_cloud.size());
 
-    encode_log.raw_byte_size = point_cloud.size() * sizeof(UncompressedVoxel);
+    ctx.encode_log.raw_byte_size = point_cloud.size() * sizeof(UncompressedVoxel);
 
     if(settings.verbose) {
         std::cout << "POINT CLOUD\n";
         std::cout << "  > size " << num_points << std::endl;
     }
 
+    // quantize all points & calc cell indexes in a single pass,
+    // num_cells denotes points outside of bounding box
+    std::vector<QuantizedVoxel>& quantized = ctx.arena_.quantized;
+    std::vector<unsigned>& point_cell_idx = ctx.arena_.point_cell_idx;
+    quantized.resize(static_cast<size_t>(num_points));
+    point_cell_idx.resize(static_cast<size_t>(num_points));
+    std::atomic<int> discarded_by_bb(0);
+    parallelFor(0, static_cast<size_t>(num_points), [&](size_t i) {
+        if (!ctx.pc_grid_->bounding_box.contains(point_cloud[i].pos)) {
+            point_cell_idx[i] = num_cells;
+            discarded_by_bb++;
+            return;
+        }
+        unsigned cell_idx = calcGridCellIndex(ctx, point_cloud[i].pos, cell_range);
+        Vec<float> pos_cell = mapToCell(ctx, point_cloud[i].pos, cell_range);
+        Vec<uint64_t> comp_clr = mapVec(point_cloud[i].color_rgba, bb_clr,
+                                        precision.color_precision[cell_idx]);
+        QuantizedVoxel& v = quantized[i];
+        v.setPos(mapVec(pos_cell, bb_cell, precision.point_precision[cell_idx]));
+        v.clr[0] = static_cast<uint32_t>(comp_clr.x);
+        v.clr[1] = static_cast<uint32_t>(comp_clr.y);
+        v.clr[2] = static_cast<uint32_t>(comp_clr.z);
+        v.point_idx = static_cast<unsigned>(i);
+        point_cell_idx[i] = cell_idx;
+    });
+
+    // count points per cell, points are split into blocks
+    // each counting its points in a histogram of its own
+    auto n = static_cast<size_t>(num_points);
+    size_t num_blocks = calcNumHistogramBlocks(n, num_cells, getLoopThreads());
+    std::vector<size_t>& histograms = ctx.arena_.cell_histograms;
+    histograms.assign(num_blocks * num_cells, 0);
+    parallelFor(0, num_blocks, [&](size_t b) {
+        size_t* hist = &histograms[b * num_cells];
+        for(size_t i = n * b / num_blocks; i < n * (b + 1) / num_blocks; ++i) {
+            if(point_cell_idx[i] < num_cells)
+                hist[point_cell_idx[i]] += 1;
+        }
+    }, 1);
+
+    // exclusive prefix sum ordered by cell, then block,
+    // thus histograms hold the first bucket index of every block per cell
+    std::vector<size_t>& cell_begin = ctx.arena_.cell_begin;
+    cell_begin.resize(num_cells + 1);
+    size_t sum = 0;
+    for(unsigned cell_idx = 0; cell_idx < num_cells; ++cell_idx) {
+        cell_begin[cell_idx] = sum;
+        for(size_t b = 0; b < num_blocks; ++b) {
+            size_t count = histograms[b * num_cells + cell_idx];
+            histograms[b * num_cells + cell_idx] = sum;
+            sum += count;
+        }
+    }
+    cell_begin[num_cells] = sum;
+
+    time_t quantize = t.stopWatch();
+
     // discard overlapping points after quantization
     // and calc overall point color by incremental mean.
-    // - not parallelized, thus slower.
+    // - quantized voxels are bucketed by cell, sorted by position
+    //   and reduced per cell in parallel.
     // - reduces number of points in grid (compared to original) for increasing coarsity of abstraction
     if(settings.irrelevance_coding) {
-        std::vector<PropertyMap> cell_prop_map(num_cells);
-        PropertyMap::iterator it;
-        int discarded_by_bb = 0;
-        int discarded_by_cell = 0;
-        for(unsigned i=0; (int) i < num_points; ++i) {
-            if (!pc_grid_->bounding_box.contains(point_cloud[i].pos)) {
-                discarded_by_bb++;
-                continue;
+        // bucket quantized voxels by cell, blocks scatter in parallel,
+        // each cell keeps its voxels in input order
+        std::vector<QuantizedVoxel>& bucketed = ctx.arena_.bucketed;
+        bucketed.resize(cell_begin[num_cells]);
+        parallelFor(0, num_blocks, [&](size_t b) {
+            size_t* hist = &histograms[b * num_cells];
+            for(size_t i = n * b / num_blocks; i < n * (b + 1) / num_blocks; ++i) {
+                if(point_cell_idx[i] < num_cells)
+                    bucketed[hist[point_cell_idx[i]]++] = quantized[i];
             }
-            Vec<float> pos_cell = mapToCell(point_cloud[i].pos, cell_range);
-            unsigned cell_idx = calcGridCellIndex(point_cloud[i].pos, cell_range);
-            Vec<uint64_t> comp_pos = mapVec(pos_cell, bb_cell,
-                                            settings.grid_precision.point_precision[cell_idx]);
-            Vec<uint64_t> comp_clr = mapVec(point_cloud[i].color_rgba, bb_clr,
-                                            settings.grid_precision.color_precision[cell_idx]);
-            it = cell_prop_map[cell_idx].find(comp_pos);
-            if(it == cell_prop_map[cell_idx].end()) {
-                cell_prop_map[cell_idx].insert(PropertyPair(
-                        comp_pos, std::pair<Vec<uint64_t>, int>(comp_clr, 1)));
-            } else {
-                discarded_by_cell++;
-                std::pair<Vec<uint64_t>, int> prop = it->second;
-                prop.second += 1;
-                float weight = 1 / (float) (prop.second);
-                float new_r = weight * (float) comp_clr.x + (1-weight) * (float) prop.first.x;
-                float new_g = weight * (float) comp_clr.y + (1-weight) * (float) prop.first.y;
-                float new_b = weight * (float) comp_clr.z + (1-weight) * (float) prop.first.z;
-                prop.first = Vec<uint64_t>((uint64_t) new_r,(uint64_t) new_g,(uint64_t) new_b);
-                cell_prop_map[cell_idx][comp_pos] = prop;
+        }, 1);
+
+        // sort each cell by position (ties in input order)
+        // and average colors of voxels with equal position
+        std::atomic<int> discarded_by_cell(0);
+        parallelFor(0, num_cells, [&](size_t cell_idx) {
+            auto first = bucketed.begin() + cell_begin[cell_idx];
+            auto last = bucketed.begin() + cell_begin[cell_idx + 1];
+            std::sort(first, last);
+            GridCell* cell = (*ctx.pc_grid_)[cell_idx];
+            int discarded = 0;
+            for(auto it = first; it != last;) {
+                float clr[3] = {(float) it->clr[0], (float) it->clr[1], (float) it->clr[2]};
+                auto run = it + 1;
+                int count = 1;
+                for(; run != last && run->samePos(*it); ++run) {
+                    ++count;
+                    float weight = 1 / (float) count;
+                    for(unsigned c = 0; c < 3; ++c)
+                        clr[c] = (float) (uint64_t) (weight * (float) run->clr[c] + (1-weight) * clr[c]);
+                }
+                discarded += count - 1;
+                cell->addVoxel(it->getPos(), Vec<uint64_t>((uint64_t) clr[0], (uint64_t) clr[1], (uint64_t) clr[2]));
+                it = run;
             }
-        }
-
-        for(unsigned cell_idx = 0; cell_idx < num_cells; ++cell_idx) {
-            (*pc_grid_)[cell_idx]->resize(cell_prop_map[cell_idx].size());
-            int elmnt_idx = 0;
-            for(it = cell_prop_map[cell_idx].begin(); it != cell_prop_map[cell_idx].end(); ++it) {
-                (*pc_grid_)[cell_idx]->points[elmnt_idx] = it->first;
-                (*pc_grid_)[cell_idx]->colors[elmnt_idx] = it->second.first;
-                ++elmnt_idx;
-            }
-        }
+            discarded_by_cell += discarded;
+        }, 1);
 
         time_t fill_grid = t.stopWatch();
 
-        encode_log.comp_time = fill_grid;
+        ctx.encode_log.comp_time = fill_grid;
 
         if(settings.verbose) {
             std::cout << "POINTS DISCARDED \n";
@@ -310,126 +1108,104 @@ void PointCloudGridEncoder::buildPointCloudGrid(const std::vector<UncompressedVo
     // keep overlapping points
     // - parallel computation, thus faster
     // - number of points in grid equal to points in uncompressed point cloud
+    // - points are radix sorted by (cell index, quantized position),
+    //   thus every cell is filled from one contiguous, spatially sorted range
     else {
-        std::vector<int> discarded_by_bb(max_threads, 0);
-        // calculate cell indexes for points
-        // and number of elements per thread grid cell
-#pragma omp parallel for schedule(static)
-        for(unsigned i=0; (int) i < num_points; ++i) {
-            int t_num = omp_get_thread_num();
-            if (!pc_grid_->bounding_box.contains(point_cloud[i].pos)) {
-                discarded_by_bb[t_num] += 1;
-                continue;
-            }
-            unsigned cell_idx = calcGridCellIndex(point_cloud[i].pos, cell_range);
-            t_grid_elmts[t_num][cell_idx] += 1;
-            point_cell_idx[i] = cell_idx;
-        }
-
-        int total_discarded_by_bb = 0;
-        for(auto disc_bb : discarded_by_bb) {
-            total_discarded_by_bb += disc_bb;
-        }
-
         if(settings.verbose) {
-            std::cout << "POINTS DISCARDED BY BoundingBox " << total_discarded_by_bb << std::endl;
-            std::cout << "  > " << num_points - total_discarded_by_bb << " voxels left.\n";
+            std::cout << "POINTS DISCARDED BY BoundingBox " << discarded_by_bb << std::endl;
+            std::cout << "  > " << num_points - discarded_by_bb << " voxels left.\n";
         }
 
-        // resize grid cells based on summing elements per thread grid cell
-        // and create offsets of thread grid cell insert into main grid
-        std::vector<std::vector<unsigned>> t_curr_elmt(max_threads, std::vector<unsigned>(num_cells,0));
-        size_t cell_size = 0;
-        for(unsigned cell_idx=0; cell_idx < num_cells; ++cell_idx) {
-            for(unsigned t_num=1; t_num < t_curr_elmt.size(); ++t_num)
-                t_curr_elmt[t_num][cell_idx] += t_curr_elmt[t_num-1][cell_idx] + t_grid_elmts[t_num-1][cell_idx];
-            cell_size = t_curr_elmt[max_threads-1][cell_idx] + t_grid_elmts[max_threads-1][cell_idx];
-            (*pc_grid_)[cell_idx]->resize(cell_size);
+        // cell index is stored in upper key bits,
+        // remaining bits hold the most significant bits of the quantized position
+        unsigned cell_bits = 1;
+        while(cell_bits < 32 && (uint64_t(1) << cell_bits) <= num_cells)
+            ++cell_bits;
+        unsigned max_pos_bits = 0;
+        for(unsigned cell_idx = 0; cell_idx < num_cells; ++cell_idx) {
+            Vec<BitCount> M_P = precision.point_precision[cell_idx];
+            max_pos_bits = std::max(max_pos_bits, static_cast<unsigned>(M_P.x + M_P.y + M_P.z));
         }
+        unsigned pos_bits = std::min(max_pos_bits, 64 - cell_bits);
+
+        std::vector<KeyValuePair>& sorted = ctx.arena_.sorted;
+        sorted.resize(static_cast<size_t>(num_points));
+        parallelFor(0, static_cast<size_t>(num_points), [&](size_t i) {
+            unsigned cell_idx = point_cell_idx[i];
+            uint64_t pos_code = 0;
+            if(cell_idx < num_cells)
+                pos_code = calcPositionCode(quantized[i].getPos(),
+                                            precision.point_precision[cell_idx], pos_bits);
+            sorted[i].key = (static_cast<uint64_t>(cell_idx) << pos_bits) | pos_code;
+            sorted[i].value = static_cast<unsigned>(i);
+        });
+        radixSort(sorted, ctx.arena_.radix_sort, cell_bits + pos_bits, *thread_pool_, getLoopThreads());
+
+        for(unsigned cell_idx = 0; cell_idx < num_cells; ++cell_idx)
+            (*ctx.pc_grid_)[cell_idx]->resize(cell_begin[cell_idx + 1] - cell_begin[cell_idx]);
 
         time_t calc_offset = t.stopWatch();
 
-        // insert compressed points into main grid
-#pragma omp parallel for schedule(static)
-        for(int i=0; i < num_points; ++i) {
-            int t_num = omp_get_thread_num();
-            if (!pc_grid_->bounding_box.contains(point_cloud[i].pos))
-                continue;
-            Vec<float> pos_cell = mapToCell(point_cloud[i].pos, cell_range);
-            unsigned cell_idx = point_cell_idx[i];
-            unsigned elmnt_idx = t_curr_elmt[t_num][cell_idx];
-            (*pc_grid_)[cell_idx]->points[elmnt_idx] = mapVec(pos_cell, bb_cell,
-                                                              settings.grid_precision.point_precision[cell_idx]);
-            (*pc_grid_)[cell_idx]->colors[elmnt_idx] = mapVec(point_cloud[i].color_rgba, bb_clr,
-                                                              settings.grid_precision.color_precision[cell_idx]);
-            t_curr_elmt[t_num][cell_idx] += 1;
-        }
+        // insert compressed points into main grid,
+        // points outside of bounding box have been sorted to the end
+        parallelFor(0, cell_begin[num_cells], [&](size_t i) {
+            const QuantizedVoxel& v = quantized[sorted[i].value];
+            unsigned cell_idx = point_cell_idx[sorted[i].value];
+            auto elmnt_idx = static_cast<unsigned>(i - cell_begin[cell_idx]);
+            (*ctx.pc_grid_)[cell_idx]->points.set(elmnt_idx, v.getPos());
+            (*ctx.pc_grid_)[cell_idx]->colors.set(elmnt_idx, Vec<uint64_t>(v.clr[0], v.clr[1], v.clr[2]));
+        });
 
         time_t fill_grid = t.stopWatch();
 
-        encode_log.comp_time = fill_grid;
+        ctx.encode_log.comp_time = fill_grid;
 
         if(settings.verbose) {
             std::cout << "DONE building grid\n";
             std::cout << "  > took " << fill_grid << "ms.\n";
-            std::cout << "    > offset calculation " << calc_offset << "ms.\n";
+            std::cout << "    > quantization " << quantize << "ms.\n";
+            std::cout << "    > sorting " << calc_offset - quantize << "ms.\n";
             std::cout << "    > filling grid " << fill_grid - calc_offset << "ms.\n";
         }
     }
 }
 
-bool PointCloudGridEncoder::extractPointCloudFromGrid(std::vector<UncompressedVoxel>* point_cloud)
+bool PointCloudGridEncoder::extractPointCloudFromGrid(Context& ctx, std::vector<UncompressedVoxel>* point_cloud) const
 {
     // calc num total points once
     // to resize point_cloud
     unsigned num_grid_points = 0;
-    for(auto cell: pc_grid_->cells)
+    for(auto cell: ctx.pc_grid_->cells)
         num_grid_points += cell->size();
     point_cloud->clear();
     point_cloud->resize(num_grid_points);
     // calc cell range for local point mapping
-    Vec<float> cell_range = pc_grid_->bounding_box.calcRange();
-    cell_range.x /= (float) pc_grid_->dimensions.x;
-    cell_range.y /= (float) pc_grid_->dimensions.y;
-    cell_range.z /= (float) pc_grid_->dimensions.z;
+    Vec<float> cell_range = ctx.pc_grid_->bounding_box.calcRange();
+    cell_range.x /= (float) ctx.pc_grid_->dimensions.x;
+    cell_range.y /= (float) ctx.pc_grid_->dimensions.y;
+    cell_range.z /= (float) ctx.pc_grid_->dimensions.z;
     BoundingBox bb_cell(Vec<float>(0.0f,0.0f,0.0f), cell_range);
     BoundingBox bb_clr(Vec<float>(0.0f,0.0f,0.0f), Vec<float>(255.0f,255.0f,255.0f));
 
-    std::vector<std::vector<unsigned>> point_idx;
-    std::vector<unsigned> white_cells;
-    point_idx.resize(pc_grid_->cells.size());
+    // index of first point per cell in point_cloud
+    std::vector<unsigned>& point_offsets = ctx.arena_.point_offsets;
+    std::vector<unsigned>& white_cells = ctx.arena_.white_cells;
+    point_offsets.assign(ctx.pc_grid_->cells.size(), 0);
+    white_cells.clear();
     unsigned cell_offset = 0;
-    for(unsigned i = 0; i < pc_grid_->cells.size(); ++i) {
-        point_idx[i].resize(pc_grid_->cells[i]->size());
-        for(unsigned j = 0; j < pc_grid_->cells[i]->size(); ++j)
-            point_idx[i][j] = cell_offset+j;
-        cell_offset += pc_grid_->cells[i]->size();
-        if(pc_grid_->cells[i]->size() > 0)
+    for(unsigned i = 0; i < ctx.pc_grid_->cells.size(); ++i) {
+        point_offsets[i] = cell_offset;
+        cell_offset += ctx.pc_grid_->cells[i]->size();
+        if(ctx.pc_grid_->cells[i]->size() > 0)
             white_cells.emplace_back(i);
     }
 
-    std::vector<Vec8> cell_idx_to_dim;
-    cell_idx_to_dim.resize(pc_grid_->dimensions.x*pc_grid_->dimensions.y*pc_grid_->dimensions.z);
-    for(uint8_t x_idx=0; x_idx < pc_grid_->dimensions.x; ++x_idx) {
-        for (uint8_t y_idx = 0; y_idx < pc_grid_->dimensions.y; ++y_idx) {
-            for (uint8_t z_idx = 0; z_idx < pc_grid_->dimensions.z; ++z_idx) {
-                unsigned cell_idx = x_idx +
-                                    y_idx * pc_grid_->dimensions.x +
-                                    z_idx * pc_grid_->dimensions.x * pc_grid_->dimensions.y;
-                cell_idx_to_dim[cell_idx].x = x_idx;
-                cell_idx_to_dim[cell_idx].y = y_idx;
-                cell_idx_to_dim[cell_idx].z = z_idx;
-            }
-        }
-    }
-
     Measure m;
     m.startWatch();
 
-#pragma omp parallel for
-    for (unsigned i = 0; i < white_cells.size(); ++i) {
+    parallelFor(0, white_cells.size(), [&](size_t i) {
         unsigned cell_idx = white_cells[i];
-        GridCell *cell = pc_grid_->cells[cell_idx];
+        GridCell *cell = ctx.pc_grid_->cells[cell_idx];
         Vec<uint8_t> p_bits(
                 cell->points.getNX(),
                 cell->points.getNY(),
@@ -440,241 +1216,298 @@ bool PointCloudGridEncoder::extractPointCloudFromGrid(std::vector<UncompressedVo
                 cell->colors.getNY(),
                 cell->colors.getNZ()
         );
-        Vec<float> glob_cell_min = Vec<float>(
-                cell_range.x * cell_idx_to_dim[cell_idx].x,
-                cell_range.y * cell_idx_to_dim[cell_idx].y,
-                cell_range.z * cell_idx_to_dim[cell_idx].z
-        );
-        glob_cell_min += pc_grid_->bounding_box.min;
+        Vec<float> glob_cell_min = calcGridCellBoundingBox(ctx, cell_idx, cell_range).min;
         Vec<float> pos_cell, clr;
+        UncompressedVoxel* voxels = point_cloud->data() + point_offsets[cell_idx];
         for (unsigned j = 0; j < cell->size(); ++j) {
-            pos_cell = Encoder::mapVecToFloat(pc_grid_->cells[cell_idx]->points[j], bb_cell, p_bits);
+            pos_cell = Encoder::mapVecToFloat(cell->points[j], bb_cell, p_bits);
             pos_cell += glob_cell_min;
-            clr = Encoder::mapVecToFloat(pc_grid_->cells[cell_idx]->colors[j], bb_clr, c_bits);
-            (*point_cloud)[point_idx[cell_idx][j]].pos[0] = pos_cell.x;
-            (*point_cloud)[point_idx[cell_idx][j]].pos[1] = pos_cell.y;
-            (*point_cloud)[point_idx[cell_idx][j]].pos[2] = pos_cell.z;
-            (*point_cloud)[point_idx[cell_idx][j]].color_rgba[0] = 255;
-            (*point_cloud)[point_idx[cell_idx][j]].color_rgba[1] = (unsigned char) clr.x;
-            (*point_cloud)[point_idx[cell_idx][j]].color_rgba[2] = (unsigned char) clr.y;
-            (*point_cloud)[point_idx[cell_idx][j]].color_rgba[3] = (unsigned char) clr.z;
+            clr = Encoder::mapVecToFloat(cell->colors[j], bb_clr, c_bits);
+            voxels[j].pos[0] = pos_cell.x;
+            voxels[j].pos[1] = pos_cell.y;
+            voxels[j].pos[2] = pos_cell.z;
+            voxels[j].color_rgba[0] = 255;
+            voxels[j].color_rgba[1] = (unsigned char) clr.x;
+            voxels[j].color_rgba[2] = (unsigned char) clr.y;
+            voxels[j].color_rgba[3] = (unsigned char) clr.z;
         }
-    }
+    });
 
-    decode_log.decomp_time = m.stopWatch();
+    ctx.decode_log.decomp_time = m.stopWatch();
 
     if(settings.verbose) {
         std::cout << "DECOMPRESSION done.\n";
-        std::cout << "  > took " << decode_log.decomp_time << "ms.\n";
+        std::cout << "  > took " << ctx.decode_log.decomp_time << "ms.\n";
     }
 
     return true;//point_idx == point_cloud->size();
 }
 
-zmq::message_t PointCloudGridEncoder::encodePointCloudGrid() {
+size_t PointCloudGridEncoder::encodePointCloudGrid(Context& ctx, unsigned char* out) const {
     Measure m;
     m.startWatch();
 
-    std::vector<unsigned> black_list;
-    std::vector<CellHeader*> cell_headers;
+    const std::vector<unsigned char>& black_cells = ctx.arena_.black_cells;
+    unsigned num_blacklist = 0;
+    std::vector<unsigned>& skip_list = ctx.arena_.skip_list;
+    std::vector<CellHeader>& cell_headers = ctx.arena_.cell_headers;
+    skip_list.clear();
+    cell_headers.clear();
     // initialize cell headers
     int total_elements = 0;
-    for(unsigned cell_idx = 0; cell_idx < pc_grid_->cells.size(); ++cell_idx) {
-        if(pc_grid_->cells[cell_idx]->size() == 0) {
-            black_list.push_back(cell_idx);
+    for(unsigned cell_idx = 0; cell_idx < ctx.pc_grid_->cells.size(); ++cell_idx) {
+        if(black_cells[cell_idx]) {
+            ++num_blacklist;
             continue;
         }
-        auto c_header = new CellHeader;
-        c_header->cell_idx = cell_idx;
-        // TODO extend header with precise encoding
-        c_header->point_encoding_x = (*pc_grid_)[cell_idx]->points.getNX();
-        c_header->point_encoding_y = (*pc_grid_)[cell_idx]->points.getNY();
-        c_header->point_encoding_z = (*pc_grid_)[cell_idx]->points.getNZ();
-        c_header->color_encoding_x = (*pc_grid_)[cell_idx]->colors.getNX();
-        c_header->color_encoding_y = (*pc_grid_)[cell_idx]->colors.getNY();
-        c_header->color_encoding_z = (*pc_grid_)[cell_idx]->colors.getNZ();
-        c_header->num_elements = pc_grid_->cells[cell_idx]->size();
-        cell_headers.push_back(c_header);
-        total_elements += c_header->num_elements;
+        if(ctx.cell_skipped_[cell_idx]) {
+            skip_list.push_back(cell_idx);
+            continue;
+        }
+        cell_headers.emplace_back();
+        initCellHeader(ctx, cell_idx, &cell_headers.back());
+        total_elements += cell_headers.back().num_elements;
     }
 
     // fill global header
-    header_->num_blacklist = static_cast<unsigned>(black_list.size());
-    header_->dimensions = pc_grid_->dimensions;
-    header_->bounding_box = pc_grid_->bounding_box;
-
-    // calc overall message size and init message
-    size_t message_size_bytes = calcMessageSize(cell_headers);
-    zmq::message_t message(message_size_bytes);
-
-    size_t offset = encodeGridHeader(message);
-    offset = encodeBlackList(message, black_list, offset);
+    ctx.header_.num_blacklist = num_blacklist;
+    ctx.header_.num_skipped = static_cast<unsigned>(skip_list.size());
+    ctx.header_.dimensions = ctx.pc_grid_->dimensions;
+    ctx.header_.bounding_box = ctx.pc_grid_->bounding_box;
+    ctx.header_.offset_table = settings.cell_offset_table;
+
+    size_t offset = encodeGridHeader(ctx, out);
+    offset = encodeBlackList(out, black_cells, offset);
+    offset = encodeSkipList(out, skip_list, offset);
+    size_t table_offset = offset;
+    if(ctx.header_.offset_table)
+        offset += cell_headers.size() * sizeof(unsigned);
 
     time_t pre_cells = m.stopWatch();
 
     // Calculate offsets prior to message encoding
-    // to be able to parallelize message creation
-    std::vector<size_t> cell_offsets(cell_headers.size(), 0);
-    for(unsigned i = 0; i < cell_headers.size(); ++i) {
-        if(i == 0) {
-            cell_offsets[i] += offset;
-        }
-        else {
-            cell_offsets[i] = cell_offsets[i-1];
-            cell_offsets[i] += CellHeader::getByteSize();
-            cell_offsets[i] += BitVecArray::getByteSize(
-                cell_headers[i-1]->num_elements,
-                cell_headers[i-1]->point_encoding_x,
-                cell_headers[i-1]->point_encoding_y,
-                cell_headers[i-1]->point_encoding_z
-            );
-            cell_offsets[i] += BitVecArray::getByteSize(
-                    cell_headers[i-1]->num_elements,
-                    cell_headers[i-1]->color_encoding_x,
-                    cell_headers[i-1]->color_encoding_y,
-                    cell_headers[i-1]->color_encoding_z
-            );
+    // to be able to parallelize message creation.
+    // Last offset denotes the end of the message.
+    // Precisions refer to the previous header,
+    // unless cells are located by offset table.
+    auto prev_header = [&](unsigned i) -> const CellHeader* {
+        return ctx.header_.offset_table || i == 0 ? nullptr : &cell_headers[i-1];
+    };
+    std::vector<size_t>& cell_offsets = ctx.arena_.cell_offsets;
+    cell_offsets.assign(cell_headers.size() + 1, offset);
+    for(unsigned i = 1; i < cell_offsets.size(); ++i) {
+        cell_offsets[i] = cell_offsets[i-1];
+        cell_offsets[i] += calcCellHeaderSize(ctx, &cell_headers[i-1], prev_header(i-1));
+        cell_offsets[i] += calcCellDataSize(ctx, cell_headers[i-1].cell_idx);
+    }
+    if(ctx.header_.offset_table) {
+        for(unsigned i = 0; i < cell_headers.size(); ++i) {
+            storeU32(out + table_offset + i * sizeof(unsigned), static_cast<uint32_t>(cell_offsets[i]));
         }
     }
 
     // generate message content for cells in parallel
-    #pragma omp parallel for
-    for(unsigned i = 0; i < cell_headers.size(); ++i) {
+    parallelFor(0, cell_headers.size(), [&](size_t i) {
         size_t temp_offset(cell_offsets[i]);
-        temp_offset = encodeCellHeader(message, cell_headers[i], temp_offset);
-        encodeCell(message, pc_grid_->cells[cell_headers[i]->cell_idx], temp_offset);
-    }
+        temp_offset = encodeCellHeader(ctx, out, &cell_headers[i], prev_header(i), temp_offset);
+        encodeCell(ctx, out, cell_headers[i].cell_idx, temp_offset);
+    });
 
-    // Cleanup
-    while(!cell_headers.empty()) {
-        delete cell_headers.back();
-        cell_headers.pop_back();
-    }
+    size_t message_size_bytes = cell_offsets.back();
 
     time_t post_cells = m.stopWatch();
 
-    encode_log.encode_time = post_cells;
-    encode_log.comp_byte_size = message_size_bytes;
+    ctx.encode_log.encode_time = post_cells;
+    ctx.encode_log.comp_byte_size = message_size_bytes;
 
     if(settings.verbose) {
         std::cout << "ENCODING done.\n";
-        std::cout << "  > took " << encode_log.encode_time << "ms.\n";
+        std::cout << "  > " << (ctx.header_.delta_frame ? "delta frame " : "keyframe ") << ctx.header_.frame_idx;
+        std::cout << ", " << skip_list.size() << " cells skipped\n";
+        std::cout << "  > took " << ctx.encode_log.encode_time << "ms.\n";
         std::cout << "    > pre-encode cells " << pre_cells << "ms.\n";
         std::cout << "    > encode cells " << post_cells-pre_cells << "ms.\n";
     }
-    return message;
+    return message_size_bytes;
 }
 
-bool PointCloudGridEncoder::decodePointCloudGrid(zmq::message_t& msg)
+bool PointCloudGridEncoder::decodePointCloudGrid(Context& ctx, const unsigned char* msg, size_t size, size_t max_points,
+                                                 const Frustum* region) const
 {
-    size_t offset = decodeGlobalHeader(msg);
-
-
-    zmq::message_t decomp_msg(global_header_->uncompressed_size);
-    
-    if(global_header_->entropy_coding){
-      decomp_msg = entropyDecompression(msg, offset);
-    } else {
-      memcpy((unsigned char*) decomp_msg.data(),(unsigned char*) msg.data() + offset, global_header_->uncompressed_size);
+    size_t offset = decodeGlobalHeader(msg, size, ctx.global_header_);
+    if(offset == 0)
+        return false;
+    size_t payload_size = size - offset - ctx.global_header_.appendix_size;
+
+    // uncompressed & range coded grid is read in place,
+    // entropy coded grid is decompressed into Context::grid_buffer_
+    const unsigned char* decomp_msg = msg + offset;
+    if(ctx.global_header_.entropy_coding && !isRangeCoded(ctx)){
+        const EntropyCoder* coder = findEntropyCoder(ctx.global_header_.entropy_backend);
+        if(coder == nullptr)
+            return false;
+        // grid buffer is sized after the chunk table has been checked
+        // against the untrusted uncompressed_size
+        if(!entropyDecompression(ctx, coder, msg + offset, payload_size,
+                                 ctx.grid_buffer_, ctx.global_header_.uncompressed_size))
+            return false;
+        decomp_msg = ctx.grid_buffer_.data();
+    } else if(ctx.global_header_.uncompressed_size > payload_size) {
+        return false;
     }
-    size_t old_offset = 0;
-    offset = 0;
-    offset = decodeGridHeader(decomp_msg, offset);
-    if(offset == old_offset)
+    offset = decodeGridHeader(ctx, decomp_msg, ctx.global_header_.uncompressed_size);
+    if(offset == 0)
         return false;
 
-    pc_grid_->resize(header_->dimensions);
-    pc_grid_->bounding_box = header_->bounding_box;
-
-    std::vector<unsigned> black_list;
-    offset = decodeBlackList(decomp_msg, black_list, offset);
-
-    std::set<unsigned> black_set;
-    for(unsigned idx : black_list)
-        black_set.insert(idx);
+    // delta frames are decoded onto the previously decoded frame
+    bool has_reference = ctx.decoded_frame_valid_ &&
+                         ctx.header_.frame_idx == ctx.decoded_frame_idx_ + 1 &&
+                         ctx.pc_grid_->dimensions == ctx.header_.dimensions &&
+                         sameBoundingBox(ctx.pc_grid_->bounding_box, ctx.header_.bounding_box);
+    ctx.decoded_frame_valid_ = false;
+    if(ctx.header_.delta_frame && !has_reference) {
+        if(settings.verbose)
+            std::cout << "NOTIFICATION: delta frame " << ctx.header_.frame_idx << " without reference frame.\n";
+        return false;
+    }
+    if(!ctx.header_.delta_frame && ctx.header_.num_skipped > 0)
+        return false;
+    if(!ctx.header_.delta_frame)
+        ctx.pc_grid_->resize(ctx.header_.dimensions);
+    ctx.pc_grid_->bounding_box = ctx.header_.bounding_box;
+
+    size_t num_cells = ctx.header_.dimensions.x * ctx.header_.dimensions.y * ctx.header_.dimensions.z;
+    size_t grid_header_end = offset;
+    std::vector<unsigned char>& black_cells = ctx.arena_.black_cells;
+    offset = decodeBlackList(ctx, decomp_msg, black_cells, offset);
+    if(offset == 0 || ctx.header_.num_skipped > num_cells ||
+       offset + ctx.header_.num_skipped * sizeof(unsigned) > ctx.global_header_.uncompressed_size)
+        return false;
+    size_t black_list_size = offset - grid_header_end;
+
+    std::vector<unsigned>& skip_list = ctx.arena_.skip_list;
+    offset = decodeSkipList(ctx, decomp_msg, skip_list, offset);
+
+    // skipped cells keep their content, all other cells are decoded from scratch
+    std::vector<unsigned char>& skipped = ctx.arena_.skipped;
+    skipped.assign(num_cells, 0);
+    for(unsigned idx : skip_list) {
+        if(idx >= num_cells)
+            return false;
+        skipped[idx] = 1;
+    }
+    if(ctx.header_.delta_frame) {
+        for(unsigned c_idx = 0; c_idx < num_cells; ++c_idx) {
+            if(!skipped[c_idx] || black_cells[c_idx])
+                ctx.pc_grid_->cells[c_idx]->clear();
+        }
+    }
 
     Measure t;
     t.startWatch();
 
-    // Extract Cell Headers to
-    // calculate grid data offsets prior to message decoding
-    // to be able to parallelize grid data extraction
-    size_t num_cells = header_->dimensions.x * header_->dimensions.y * header_->dimensions.z;
-    size_t num_white_cells = num_cells - black_set.size();
-    // Stores message offset per whitelisted grid cell
-    // offset encodes start position for memcpy to retrieve point&color data for cell
-    std::vector<size_t> cell_offsets(num_white_cells, 0);
-    // Stores cell header per whitelisted grid cell
-    std::vector<CellHeader*> cell_headers(num_white_cells, nullptr);
-    unsigned header_idx = 0;
-    old_offset = offset;
+    std::vector<unsigned>& white_cells = ctx.arena_.white_cells;
+    white_cells.clear();
     for(unsigned c_idx = 0; c_idx < num_cells; ++c_idx) {
-        if (black_set.find(c_idx) != black_set.end())
-            continue;
-        cell_headers[header_idx] = new CellHeader;
-        cell_headers[header_idx]->cell_idx = c_idx;
-        if(header_idx == 0) {
-            cell_offsets[header_idx] += offset;
-            cell_offsets[header_idx] = decodeCellHeader(decomp_msg, cell_headers[header_idx], cell_offsets[header_idx]);
-            if(cell_offsets[header_idx] == old_offset) {
-                while(!cell_headers.empty()) {
-                    delete cell_headers.back();
-                    cell_headers.pop_back();
-                }
-                return false;
+        if(!skipped[c_idx] && !black_cells[c_idx])
+            white_cells.push_back(c_idx);
+    }
+    size_t num_white_cells = white_cells.size();
+
+    // cells outside of region are neither unpacked nor extracted
+    std::vector<unsigned char>& selected = ctx.arena_.selected;
+    selected.assign(num_white_cells, 1);
+    bool partial = false;
+    if(region != nullptr) {
+        Vec<float> cell_range = ctx.pc_grid_->bounding_box.calcRange();
+        cell_range.x /= (float) ctx.pc_grid_->dimensions.x;
+        cell_range.y /= (float) ctx.pc_grid_->dimensions.y;
+        cell_range.z /= (float) ctx.pc_grid_->dimensions.z;
+        for(size_t i = 0; i < num_white_cells; ++i) {
+            if(!region->intersects(calcGridCellBoundingBox(ctx, white_cells[i], cell_range))) {
+                selected[i] = 0;
+                ctx.pc_grid_->cells[white_cells[i]]->clear();
+                partial = true;
             }
         }
-        else {
-            cell_offsets[header_idx] = cell_offsets[header_idx-1];
-            cell_offsets[header_idx] += BitVecArray::getByteSize(
-                    cell_headers[header_idx-1]->num_elements,
-                    cell_headers[header_idx-1]->point_encoding_x,
-                    cell_headers[header_idx-1]->point_encoding_y,
-                    cell_headers[header_idx-1]->point_encoding_z
-            );
-            cell_offsets[header_idx] += BitVecArray::getByteSize(
-                    cell_headers[header_idx-1]->num_elements,
-                    cell_headers[header_idx-1]->color_encoding_x,
-                    cell_headers[header_idx-1]->color_encoding_y,
-                    cell_headers[header_idx-1]->color_encoding_z
-            );
-            old_offset = cell_offsets[header_idx];
-            cell_offsets[header_idx] = decodeCellHeader(decomp_msg, cell_headers[header_idx], cell_offsets[header_idx]);
-            if(old_offset == cell_offsets[header_idx]) {
-                while(!cell_headers.empty()) {
-                    delete cell_headers.back();
-                    cell_headers.pop_back();
-                }
-                return false;
+        for(unsigned idx : skip_list) {
+            if(!region->intersects(calcGridCellBoundingBox(ctx, idx, cell_range))) {
+                ctx.pc_grid_->cells[idx]->clear();
+                partial = true;
             }
         }
-        ++header_idx;
     }
 
-    time_t pre_cell_decode = t.stopWatch();
+    // Extract Cell Headers to
+    // calculate grid data offsets prior to message decoding
+    // to be able to parallelize grid data extraction.
+    // Stores message offset of cell data per whitelisted grid cell
+    std::vector<size_t>& cell_offsets = ctx.arena_.cell_offsets;
+    cell_offsets.assign(num_white_cells, 0);
+    // Stores cell header per whitelisted grid cell
+    std::vector<CellHeader>& cell_headers = ctx.arena_.cell_headers;
+    cell_headers.resize(num_white_cells);
+    if(!decodeCellHeaders(ctx, decomp_msg, offset, white_cells, selected, cell_headers, cell_offsets))
+        return false;
 
-    # pragma omp parallel for
-    for(header_idx = 0; header_idx < cell_headers.size(); ++header_idx) {
-        if(cell_offsets[header_idx] == decodeCell(decomp_msg, cell_headers[header_idx], cell_offsets[header_idx])) {
-            std::cout << "WARNING: No points in cell\n  > Cell should've been blacklisted.\n";
+    // drop headers of cells not decoded
+    size_t num_selected = 0;
+    for(size_t i = 0; i < num_white_cells; ++i) {
+        if(selected[i]) {
+            cell_headers[num_selected] = cell_headers[i];
+            cell_offsets[num_selected] = cell_offsets[i];
+            ++num_selected;
         }
     }
-    
-    decode_log.total_cell_header_size = cell_headers.size() * CellHeader::getByteSize();
-
-    while(!cell_headers.empty()) {
-        delete cell_headers.back();
-        cell_headers.pop_back();
+    cell_headers.resize(num_selected);
+    cell_offsets.resize(num_selected);
+
+    // distribute point budget over cells in proportion to their size
+    uint64_t total_elements = 0;
+    for(const CellHeader& c_header : cell_headers)
+        total_elements += c_header.num_elements;
+    for(unsigned idx : skip_list)
+        total_elements += ctx.pc_grid_->cells[idx]->size();
+    bool truncated = max_points > 0 && total_elements > max_points;
+    if(truncated) {
+        for(CellHeader& c_header : cell_headers)
+            c_header.num_decoded = static_cast<unsigned>(c_header.num_elements * uint64_t(max_points) / total_elements);
+        for(unsigned idx : skip_list) {
+            GridCell* cell = ctx.pc_grid_->cells[idx];
+            subsampleCell(cell, static_cast<unsigned>(cell->size() * uint64_t(max_points) / total_elements));
+        }
     }
 
+    time_t pre_cell_decode = t.stopWatch();
+
+    std::atomic<bool> valid(true);
+    parallelForScratch(ctx, cell_headers.size(), [&](size_t header_idx, OctreeScratch& scratch) {
+        size_t cell_offset = cell_offsets[header_idx];
+        size_t cell_end = decodeCell(ctx, decomp_msg, &cell_headers[header_idx], cell_offset, scratch);
+        if(cell_end == 0) {
+            valid = false;
+        }
+        else if(cell_offset == cell_end) {
+            std::cout << "WARNING: No points in cell\n  > Cell should've been blacklisted.\n";
+        }
+    });
+    if(!valid)
+        return false;
+
     time_t post_cell_decode = t.stopWatch();
 
-    decode_log.decode_time = post_cell_decode;
-    decode_log.black_list_size = header_->num_blacklist*sizeof(unsigned);
-    decode_log.global_header_size = GlobalHeader::getByteSize();
+    ctx.decode_log.decode_time = post_cell_decode;
+    ctx.decode_log.black_list_size = black_list_size;
+    ctx.decode_log.global_header_size = GlobalHeader::getByteSize(ctx.global_header_.format_version);
+
+    // subsampled & partially decoded frames are no reference for subsequent delta frames
+    ctx.decoded_frame_valid_ = !truncated && !partial;
+    ctx.decoded_frame_idx_ = ctx.header_.frame_idx;
 
     if(settings.verbose) {
         std::cout << "DECODING CELLS done.\n  > took " << post_cell_decode << "ms.\n";
+        std::cout << "  > " << (ctx.header_.delta_frame ? "delta frame " : "keyframe ") << ctx.header_.frame_idx;
+        std::cout << ", " << skip_list.size() << " cells skipped\n";
         std::cout << "    > decode headers " << pre_cell_decode << "ms.\n";
         std::cout << "    > decode cells " << post_cell_decode-pre_cell_decode << "ms.\n";
     }
@@ -682,221 +1515,421 @@ bool PointCloudGridEncoder::decodePointCloudGrid(zmq::message_t& msg)
     return true;
 }
 
-size_t PointCloudGridEncoder::encodeGlobalHeader(zmq::message_t &msg, size_t offset) {
-    auto entropy_coding = new bool[1];
-    entropy_coding[0] = global_header_->entropy_coding;
-    memcpy((unsigned char*) msg.data() + offset,(unsigned char*) entropy_coding, sizeof(bool));
-    offset += sizeof(bool);
-
-    auto uncompressed_size = new unsigned long[2];
-    uncompressed_size[0] = global_header_->uncompressed_size;
-    uncompressed_size[1] = global_header_->appendix_size;
-    memcpy((unsigned char*) msg.data() + offset, (unsigned char*) uncompressed_size, 2*sizeof(unsigned long));
-    offset += 2*sizeof(unsigned long);
+bool PointCloudGridEncoder::decodeCellHeaders(Context& ctx, const unsigned char* msg, size_t offset,
+                                              const std::vector<unsigned>& white_cells,
+                                              const std::vector<unsigned char>& selected,
+                                              std::vector<CellHeader>& cell_headers,
+                                              std::vector<size_t>& cell_offsets) const
+{
+    size_t num_white_cells = white_cells.size();
+    size_t grid_size = ctx.global_header_.uncompressed_size;
+
+    std::atomic<size_t> header_bytes(0);
+
+    // without offset table, every cell header locates the next one
+    if(!ctx.header_.offset_table) {
+        for(size_t i = 0; i < num_white_cells; ++i) {
+            cell_headers[i].cell_idx = white_cells[i];
+            const CellHeader* prev = i > 0 ? &cell_headers[i-1] : nullptr;
+            cell_offsets[i] = decodeCellHeader(ctx, msg, &cell_headers[i], prev, offset);
+            if(cell_offsets[i] == 0)
+                return false;
+            header_bytes += cell_offsets[i] - offset;
+            offset = cell_offsets[i] + calcCellDataSize(ctx, msg, &cell_headers[i], cell_offsets[i]);
+        }
+        ctx.decode_log.total_cell_header_size = header_bytes;
+        return offset <= grid_size;
+    }
 
-    // cleanup
-    delete [] entropy_coding;
-    delete [] uncompressed_size;
-    return offset;
+    // offset table locates every cell header,
+    // headers of cells not selected are not read
+    size_t table_end = offset + num_white_cells * sizeof(unsigned);
+    if(table_end > grid_size)
+        return false;
+    std::vector<unsigned>& cell_begins = ctx.arena_.table_offsets;
+    cell_begins.resize(num_white_cells);
+    for(size_t i = 0; i < num_white_cells; ++i)
+        cell_begins[i] = loadU32(msg + offset + i * sizeof(unsigned));
+
+    std::atomic<bool> valid(true);
+    parallelFor(0, num_white_cells, [&](size_t i) {
+        size_t cell_end = i + 1 < num_white_cells ? cell_begins[i+1] : grid_size;
+        if(cell_begins[i] < table_end || cell_begins[i] >= cell_end) {
+            valid = false;
+            return;
+        }
+        if(!selected[i])
+            return;
+        cell_headers[i].cell_idx = white_cells[i];
+        cell_offsets[i] = decodeCellHeader(ctx, msg, &cell_headers[i], nullptr, cell_begins[i]);
+        if(cell_offsets[i] == 0 ||
+           cell_offsets[i] + calcCellDataSize(ctx, msg, &cell_headers[i], cell_offsets[i]) > cell_end) {
+            valid = false;
+            return;
+        }
+        header_bytes += cell_offsets[i] - cell_begins[i];
+    });
+    ctx.decode_log.total_cell_header_size = header_bytes;
+    return valid;
 }
 
-size_t PointCloudGridEncoder::decodeGlobalHeader(zmq::message_t &msg, size_t offset) {
-    auto entropy_coding = new bool[1];
-    memcpy((unsigned char*) entropy_coding, (unsigned char*) msg.data() + offset, sizeof(bool));
-    global_header_->entropy_coding = entropy_coding[0];
-    offset += sizeof(bool);
+size_t PointCloudGridEncoder::encodeGlobalHeader(const GlobalHeader& header, unsigned char* msg, size_t offset) const {
+    ByteWriter writer(msg, offset);
+    writer.writeU32(MESSAGE_MAGIC);
+    writer.writeU8(header.format_version);
+    uint32_t features = 0;
+    if(header.entropy_coding)
+        features |= FEATURE_ENTROPY_CODING;
+    if(header.progressive)
+        features |= FEATURE_PROGRESSIVE;
+    writer.writeU32(features);
+    writer.writeU8(header.entropy_backend);
+    writer.writeU8(header.geometry_coding);
+    writer.writeU64(header.uncompressed_size);
+    writer.writeU64(header.appendix_size);
+    return writer.getOffset();
+}
 
-    auto uncompressed_size = new unsigned long[2];
-    memcpy((unsigned char*) uncompressed_size, (unsigned char*) msg.data() + offset, 2*sizeof(unsigned long));
-    global_header_->uncompressed_size = uncompressed_size[0];
-    global_header_->appendix_size = uncompressed_size[1];
-    offset += 2*sizeof(unsigned long);
+size_t PointCloudGridEncoder::decodeGlobalHeader(const unsigned char* msg, size_t size, GlobalHeader& header) const {
+    ByteReader reader(msg, size);
+    bool has_magic = size >= sizeof(uint32_t) && loadU32(msg) == MESSAGE_MAGIC;
+    if(has_magic) {
+        reader.readU32();
+        header.format_version = static_cast<FormatVersion>(reader.readU8());
+        uint32_t features = reader.readU32();
+        if(header.format_version == FORMAT_VERSION_LEGACY || (features & ~KNOWN_FEATURES) != 0)
+            return 0;
+        header.entropy_coding = (features & FEATURE_ENTROPY_CODING) != 0;
+        header.progressive = (features & FEATURE_PROGRESSIVE) != 0;
+        header.entropy_backend = static_cast<EntropyBackend>(reader.readU8());
+        header.geometry_coding = static_cast<GeometryCoding>(reader.readU8());
+    }
+    else {
+        // FORMAT_VERSION_LEGACY starts with the entropy coding flag
+        unsigned char entropy_coding = reader.readU8();
+        if(entropy_coding > 1)
+            return 0;
+        header.format_version = FORMAT_VERSION_LEGACY;
+        header.entropy_coding = entropy_coding != 0;
+        header.progressive = false;
+        header.entropy_backend = ENTROPY_ZLIB;
+        header.geometry_coding = GEOMETRY_PACKED;
+    }
+    header.uncompressed_size = reader.readU64();
+    header.appendix_size = reader.readU64();
+    if(!reader.isValid() || header.format_version > FORMAT_VERSION_CURRENT ||
+       header.geometry_coding > GEOMETRY_OCTREE || header.appendix_size > size - reader.getOffset())
+        return 0;
+    return reader.getOffset();
+}
 
-    // cleanup
-    delete [] entropy_coding;
-    delete [] uncompressed_size;
-    return offset;
+size_t PointCloudGridEncoder::encodeGridHeader(Context& ctx, unsigned char* msg, size_t offset) const {
+    ByteWriter writer(msg, offset);
+    writer.writeU8(ctx.header_.dimensions.x);
+    writer.writeU8(ctx.header_.dimensions.y);
+    writer.writeU8(ctx.header_.dimensions.z);
+    writer.writeF32(ctx.header_.bounding_box.min.x);
+    writer.writeF32(ctx.header_.bounding_box.min.y);
+    writer.writeF32(ctx.header_.bounding_box.min.z);
+    writer.writeF32(ctx.header_.bounding_box.max.x);
+    writer.writeF32(ctx.header_.bounding_box.max.y);
+    writer.writeF32(ctx.header_.bounding_box.max.z);
+    writer.writeU32(ctx.header_.num_blacklist);
+    writer.writeU8(ctx.header_.delta_frame);
+    writer.writeU32(ctx.header_.frame_idx);
+    writer.writeU32(ctx.header_.num_skipped);
+    writer.writeU8(ctx.header_.offset_table);
+    return writer.getOffset();
 }
 
-size_t PointCloudGridEncoder::encodeGridHeader(zmq::message_t &msg, size_t offset) {
-    auto dim = new unsigned char[3];
-    size_t bytes_dim_size(3 * sizeof(unsigned char));
-    dim[0] = header_->dimensions.x;
-    dim[1] = header_->dimensions.y;
-    dim[2] = header_->dimensions.z;
-    memcpy((unsigned char*) msg.data() + offset, dim, bytes_dim_size);
-    offset += bytes_dim_size;
-
-    auto bb = new float[6];
-    size_t bytes_bb_size(6 * sizeof(float));
-    bb[0] = header_->bounding_box.min.x;
-    bb[1] = header_->bounding_box.min.y;
-    bb[2] = header_->bounding_box.min.z;
-    bb[3] = header_->bounding_box.max.x;
-    bb[4] = header_->bounding_box.max.y;
-    bb[5] = header_->bounding_box.max.z;
-
-    memcpy((unsigned char*) msg.data() + offset, (unsigned char*) bb, bytes_bb_size);
-    offset += bytes_bb_size;
-
-    auto num_blacklist = new unsigned[1];
-    size_t bytes_num_bl_size = sizeof(unsigned);
-    num_blacklist[0] = header_->num_blacklist;
-    memcpy((unsigned char*) msg.data() + offset, (unsigned char*) num_blacklist, bytes_num_bl_size);
-    offset += bytes_num_bl_size;
-
-    // cleanup
-    delete [] dim;
-    delete [] bb;
-    delete [] num_blacklist;
-    return offset;
+size_t PointCloudGridEncoder::decodeGridHeader(Context& ctx, const unsigned char* msg, size_t size, size_t offset) const
+{
+    ByteReader reader(msg, size, offset);
+    ctx.header_.dimensions.x = reader.readU8();
+    ctx.header_.dimensions.y = reader.readU8();
+    ctx.header_.dimensions.z = reader.readU8();
+    ctx.header_.bounding_box.min.x = reader.readF32();
+    ctx.header_.bounding_box.min.y = reader.readF32();
+    ctx.header_.bounding_box.min.z = reader.readF32();
+    ctx.header_.bounding_box.max.x = reader.readF32();
+    ctx.header_.bounding_box.max.y = reader.readF32();
+    ctx.header_.bounding_box.max.z = reader.readF32();
+    ctx.header_.num_blacklist = reader.readU32();
+    if(ctx.global_header_.format_version == FORMAT_VERSION_LEGACY) {
+        ctx.header_.delta_frame = false;
+        ctx.header_.frame_idx = 0;
+        ctx.header_.num_skipped = 0;
+        ctx.header_.offset_table = false;
+        return reader.isValid() ? reader.getOffset() : 0;
+    }
+    ctx.header_.delta_frame = reader.readU8() != 0;
+    ctx.header_.frame_idx = reader.readU32();
+    ctx.header_.num_skipped = reader.readU32();
+    ctx.header_.offset_table = reader.readU8() != 0;
+    return reader.isValid() ? reader.getOffset() : 0;
 }
 
-size_t PointCloudGridEncoder::decodeGridHeader(zmq::message_t& msg, size_t offset)
-{
-    auto dim = new unsigned char[3];
-    size_t bytes_dim_size(3 * sizeof(unsigned char));
-    memcpy(dim, (unsigned char*) msg.data() + offset, bytes_dim_size);
-    header_->dimensions.x = dim[0];
-    header_->dimensions.y = dim[1];
-    header_->dimensions.z = dim[2];
-    offset += bytes_dim_size;
-
-    auto bb = new float[6];
-    size_t bytes_bb(6 * sizeof(float));
-    memcpy((unsigned char*) bb, (unsigned char*) msg.data() + offset, bytes_bb);
-    header_->bounding_box.min.x = bb[0];
-    header_->bounding_box.min.y = bb[1];
-    header_->bounding_box.min.z = bb[2];
-    header_->bounding_box.max.x = bb[3];
-    header_->bounding_box.max.y = bb[4];
-    header_->bounding_box.max.z = bb[5];
-    offset += bytes_bb;
-
-    auto num_blacklist = new unsigned[1];
-    size_t bytes_num_bl(sizeof(unsigned));
-    memcpy((unsigned char*) num_blacklist, (unsigned char*) msg.data() + offset, bytes_num_bl);
-    header_->num_blacklist = num_blacklist[0];
-    offset += bytes_num_bl;
-
-    // cleanup
-    delete [] dim;
-    delete [] bb;
-    delete [] num_blacklist;
-    return offset;
+size_t PointCloudGridEncoder::encodeBlackList(unsigned char* msg, const std::vector<unsigned char>& black_cells,
+                                              size_t offset) const {
+    size_t num_cells = black_cells.size();
+    size_t bitmap_size = calcBitmapSize(num_cells);
+    if(bitmap_size <= calcRunLengthSize(black_cells)) {
+        msg[offset++] = BLACKLIST_BITMAP;
+        memset(msg + offset, 0, bitmap_size);
+        for(size_t cell_idx = 0; cell_idx < num_cells; ++cell_idx) {
+            if(black_cells[cell_idx])
+                msg[offset + cell_idx / 8] |= static_cast<unsigned char>(1 << (cell_idx % 8));
+        }
+        return offset + bitmap_size;
+    }
+
+    msg[offset++] = BLACKLIST_RUNS;
+    unsigned char current = 0;
+    uint64_t run = 0;
+    for(unsigned char flag : black_cells) {
+        if((flag != 0) != (current != 0)) {
+            offset = writeVarint(msg, offset, run);
+            current = flag != 0;
+            run = 0;
+        }
+        ++run;
+    }
+    return writeVarint(msg, offset, run);
 }
 
-size_t PointCloudGridEncoder::encodeBlackList(zmq::message_t &msg, std::vector<unsigned> bl, size_t offset) {
-    auto black_list = new unsigned[bl.size()];
-    size_t bytes_bl(bl.size() * sizeof(unsigned));
-    unsigned i=0;
-    for (unsigned elmt: bl) {
-        black_list[i] = elmt;
-        ++i;
+size_t PointCloudGridEncoder::decodeBlackList(const Context& ctx, const unsigned char* msg,
+                                              std::vector<unsigned char>& black_cells, size_t offset) const {
+    size_t num_cells = ctx.header_.dimensions.x * ctx.header_.dimensions.y * ctx.header_.dimensions.z;
+    size_t grid_size = ctx.global_header_.uncompressed_size;
+    black_cells.assign(num_cells, 0);
+
+    // FORMAT_VERSION_LEGACY lists the index of every blacklisted cell
+    if(ctx.global_header_.format_version == FORMAT_VERSION_LEGACY) {
+        size_t num_blacklist = ctx.header_.num_blacklist;
+        if(num_blacklist > num_cells || offset + num_blacklist * sizeof(unsigned) > grid_size)
+            return 0;
+        for(size_t i = 0; i < num_blacklist; ++i) {
+            unsigned cell_idx = loadU32(msg + offset);
+            offset += sizeof(unsigned);
+            if(cell_idx >= num_cells || black_cells[cell_idx])
+                return 0;
+            black_cells[cell_idx] = 1;
+        }
+        return offset;
     }
-    memcpy((unsigned char*) msg.data() + offset,(unsigned char*) black_list, bytes_bl);
-    offset += bytes_bl;
 
-    // cleanup
-    delete [] black_list;
+    if(offset + sizeof(BlackListCoding) > grid_size)
+        return 0;
+    unsigned char coding = msg[offset++];
+
+    size_t num_blacklist = 0;
+    if(coding == BLACKLIST_BITMAP) {
+        if(offset + calcBitmapSize(num_cells) > grid_size)
+            return 0;
+        for(size_t cell_idx = 0; cell_idx < num_cells; ++cell_idx) {
+            black_cells[cell_idx] = (msg[offset + cell_idx / 8] >> (cell_idx % 8)) & 1;
+            num_blacklist += black_cells[cell_idx];
+        }
+        offset += calcBitmapSize(num_cells);
+    }
+    else if(coding == BLACKLIST_RUNS) {
+        // runs have to cover all cells exactly
+        size_t cell_idx = 0;
+        unsigned char current = 0;
+        do {
+            uint64_t run = 0;
+            if(!readVarint(msg, grid_size, offset, run) || run > num_cells - cell_idx)
+                return 0;
+            if(current) {
+                memset(black_cells.data() + cell_idx, 1, run);
+                num_blacklist += run;
+            }
+            cell_idx += run;
+            current = !current;
+        } while(cell_idx < num_cells);
+    }
+    else {
+        return 0;
+    }
+    return num_blacklist == ctx.header_.num_blacklist ? offset : 0;
+}
+
+size_t PointCloudGridEncoder::encodeSkipList(unsigned char* msg, const std::vector<unsigned>& sl, size_t offset) const {
+    for(unsigned idx : sl) {
+        storeU32(msg + offset, idx);
+        offset += sizeof(unsigned);
+    }
     return offset;
 }
 
-size_t PointCloudGridEncoder::decodeBlackList(zmq::message_t &msg, std::vector<unsigned>& bl, size_t offset) {
-    bl.resize(header_->num_blacklist);
+size_t PointCloudGridEncoder::decodeSkipList(const Context& ctx, const unsigned char* msg, std::vector<unsigned>& sl,
+                                             size_t offset) const {
+    sl.resize(ctx.header_.num_skipped);
+    for(unsigned& idx : sl) {
+        idx = loadU32(msg + offset);
+        offset += sizeof(unsigned);
+    }
+    return offset;
+}
 
-    auto black_list = new unsigned[bl.size()];
-    size_t bytes_bl(bl.size() * sizeof(unsigned));
-    memcpy((unsigned char*) black_list, (unsigned char*) msg.data() + offset, bytes_bl);
-    for (unsigned i = 0; i < header_->num_blacklist; ++i)
-        bl[i] = black_list[i];
-    offset += bytes_bl;
+void PointCloudGridEncoder::initCellHeader(const Context& ctx, unsigned cell_idx, CellHeader* c_header) const
+{
+    GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+    c_header->cell_idx = cell_idx;
+    c_header->point_encoding_x = cell->points.getNX();
+    c_header->point_encoding_y = cell->points.getNY();
+    c_header->point_encoding_z = cell->points.getNZ();
+    c_header->color_encoding_x = cell->colors.getNX();
+    c_header->color_encoding_y = cell->colors.getNY();
+    c_header->color_encoding_z = cell->colors.getNZ();
+    c_header->num_elements = cell->size();
+    c_header->num_decoded = c_header->num_elements;
+}
 
-    // cleanup
-    delete [] black_list;
-    return offset;
+size_t PointCloudGridEncoder::calcCellHeaderSize(const Context& ctx, const CellHeader* c_header,
+                                                 const CellHeader* prev) const
+{
+    if(ctx.global_header_.format_version <= FORMAT_VERSION_UNPACKED_HEADERS)
+        return CellHeader::getByteSize();
+    size_t size = calcVarintSize(static_cast<uint64_t>(c_header->num_elements) << 1);
+    if(prev == nullptr || !c_header->samePrecision(*prev))
+        size += PACKED_PRECISION_SIZE;
+    return size;
 }
 
-size_t PointCloudGridEncoder::encodeCellHeader(zmq::message_t& msg, CellHeader* c_header, size_t offset)
-{
-    auto num_elmts = new unsigned[1];
-    size_t bytes_num_elmts(sizeof(unsigned));
-    num_elmts[0] = c_header->num_elements;
-    memcpy((unsigned char*) msg.data() + offset, (unsigned char*) num_elmts , bytes_num_elmts);
-    offset += bytes_num_elmts;
-
-    auto encoding = new BitCount[6];
-    size_t bytes_enc(6*sizeof(BitCount));
-    encoding[0] = c_header->point_encoding_x;
-    encoding[1] = c_header->point_encoding_y;
-    encoding[2] = c_header->point_encoding_z;
-    encoding[3] = c_header->color_encoding_x;
-    encoding[4] = c_header->color_encoding_y;
-    encoding[5] = c_header->color_encoding_z;
-    memcpy((unsigned char*) msg.data() + offset, (unsigned char*) encoding, bytes_enc);
-    offset += bytes_enc;
-
-    // cleanup
-    delete [] num_elmts;
-    delete [] encoding;
+size_t PointCloudGridEncoder::encodeCellHeader(Context& ctx, unsigned char* msg, const CellHeader* c_header,
+                                               const CellHeader* prev, size_t offset) const
+{
+    if(ctx.global_header_.format_version <= FORMAT_VERSION_UNPACKED_HEADERS) {
+        ByteWriter writer(msg, offset);
+        writer.writeU32(c_header->num_elements);
+        writer.writeU32(c_header->point_encoding_x);
+        writer.writeU32(c_header->point_encoding_y);
+        writer.writeU32(c_header->point_encoding_z);
+        writer.writeU32(c_header->color_encoding_x);
+        writer.writeU32(c_header->color_encoding_y);
+        writer.writeU32(c_header->color_encoding_z);
+        return writer.getOffset();
+    }
+
+    bool same_precision = prev != nullptr && c_header->samePrecision(*prev);
+    offset = writeVarint(msg, offset, (static_cast<uint64_t>(c_header->num_elements) << 1) | same_precision);
+    if(same_precision)
+        return offset;
+
+    // precisions in [1,32] are stored as 5 bit values in [0,31]
+    uint32_t packed = 0;
+    BitCount encoding[6] = {
+        c_header->point_encoding_x, c_header->point_encoding_y, c_header->point_encoding_z,
+        c_header->color_encoding_x, c_header->color_encoding_y, c_header->color_encoding_z
+    };
+    for(unsigned i = 0; i < 6; ++i)
+        packed |= static_cast<uint32_t>(encoding[i] - 1) << (5 * i);
+    for(unsigned i = 0; i < PACKED_PRECISION_SIZE; ++i)
+        msg[offset++] = static_cast<unsigned char>(packed >> (8 * i));
     return offset;
 }
 
-size_t PointCloudGridEncoder::decodeCellHeader(zmq::message_t& msg, CellHeader* c_header, size_t offset)
+size_t PointCloudGridEncoder::decodeCellHeader(Context& ctx, const unsigned char* msg, CellHeader* c_header,
+                                               const CellHeader* prev, size_t offset) const
 {
-    auto num_elmts = new unsigned[1];
-    size_t bytes_num_elmts(sizeof(unsigned));
-    memcpy((unsigned char*) num_elmts, (unsigned char*) msg.data() + offset, bytes_num_elmts);
-    c_header->num_elements = num_elmts[0];
-    offset += bytes_num_elmts;
+    size_t grid_size = ctx.global_header_.uncompressed_size;
+    BitCount encoding[6];
+
+    if(ctx.global_header_.format_version <= FORMAT_VERSION_UNPACKED_HEADERS) {
+        ByteReader reader(msg, grid_size, offset);
+        c_header->num_elements = reader.readU32();
+        for(BitCount& count : encoding) {
+            uint32_t value = reader.readU32();
+            if(value < BIT_1 || value > BIT_32)
+                return 0;
+            count = static_cast<BitCount>(value);
+        }
+        if(!reader.isValid())
+            return 0;
+        offset = reader.getOffset();
+    }
+    else {
+        uint64_t value = 0;
+        if(!readVarint(msg, grid_size, offset, value) || (value >> 1) > UINT32_MAX)
+            return 0;
+        c_header->num_elements = static_cast<unsigned>(value >> 1);
+        if(value & 1) {
+            // precision of previous header
+            if(prev == nullptr)
+                return 0;
+            encoding[0] = prev->point_encoding_x;
+            encoding[1] = prev->point_encoding_y;
+            encoding[2] = prev->point_encoding_z;
+            encoding[3] = prev->color_encoding_x;
+            encoding[4] = prev->color_encoding_y;
+            encoding[5] = prev->color_encoding_z;
+        }
+        else {
+            if(offset + PACKED_PRECISION_SIZE > grid_size)
+                return 0;
+            uint32_t packed = 0;
+            for(unsigned i = 0; i < PACKED_PRECISION_SIZE; ++i)
+                packed |= static_cast<uint32_t>(msg[offset++]) << (8 * i);
+            for(unsigned i = 0; i < 6; ++i)
+                encoding[i] = static_cast<BitCount>(((packed >> (5 * i)) & 0x1F) + 1);
+        }
+    }
 
-    auto encoding = new BitCount[6];
-    size_t bytes_enc(6*sizeof(BitCount));
-    memcpy((unsigned char*) encoding, (unsigned char*) msg.data() + offset, bytes_enc);
+    c_header->num_decoded = c_header->num_elements;
     c_header->point_encoding_x = encoding[0];
     c_header->point_encoding_y = encoding[1];
     c_header->point_encoding_z = encoding[2];
     c_header->color_encoding_x = encoding[3];
     c_header->color_encoding_y = encoding[4];
     c_header->color_encoding_z = encoding[5];
-    offset += bytes_enc;
-
-    // cleanup
-    delete [] num_elmts;
-    delete [] encoding;
     return offset;
 }
 
-size_t PointCloudGridEncoder::encodeCell(zmq::message_t &msg, GridCell* cell, size_t offset)
+size_t PointCloudGridEncoder::encodeCell(Context& ctx, unsigned char* msg, unsigned cell_idx, size_t offset) const
 {
+    GridCell* cell = ctx.pc_grid_->cells[cell_idx];
     if(cell->size() == 0)
         return offset;
 
+    // copy range/octree coded data behind its size
+    if(hasPrecodedCells(ctx)) {
+        const std::vector<unsigned char>& coded = ctx.coded_cells_[cell_idx];
+        storeU32(msg + offset, static_cast<uint32_t>(coded.size()));
+        offset += sizeof(unsigned);
+        memcpy(msg + offset, coded.data(), coded.size());
+        return offset + coded.size();
+    }
+
+    // copy packed data of unchanged cell
+    if(ctx.cell_cached_[cell_idx]) {
+        const std::vector<unsigned char>& packed = ctx.packed_cells_[cell_idx];
+        memcpy(msg + offset, packed.data(), packed.size());
+        return offset + packed.size();
+    }
+
+    size_t cell_offset = offset;
+
     // pack positions
-    unsigned char* p_packed = cell->points.pack();
-    size_t bytes_p(cell->points.getByteSize());
-    memcpy((unsigned char*) msg.data() + offset, p_packed, bytes_p);
-    offset += bytes_p;
+    offset += cell->points.pack(msg + offset);
 
     // pack colors
-    unsigned char* c_packed = cell->colors.pack();
-    size_t bytes_c(cell->colors.getByteSize());
-    memcpy((unsigned char*) msg.data() + offset, c_packed, bytes_c);
-    offset += bytes_c;
+    offset += cell->colors.pack(msg + offset);
 
-    delete [] p_packed;
-    delete [] c_packed;
+    if(settings.cell_caching)
+        ctx.packed_cells_[cell_idx].assign(msg + cell_offset, msg + offset);
 
     return offset;
 }
 
-size_t PointCloudGridEncoder::decodeCell(zmq::message_t &msg, CellHeader *c_header, size_t offset)
+size_t PointCloudGridEncoder::decodeCell(Context& ctx, const unsigned char* msg, CellHeader *c_header,
+                                         size_t offset, OctreeScratch& scratch) const
 {
     if(c_header->num_elements == 0)
         return offset;
 
     // TODO precise encoding
-    GridCell* cell = pc_grid_->cells[c_header->cell_idx];
+    GridCell* cell = ctx.pc_grid_->cells[c_header->cell_idx];
 
     // set BitCount and element count for position data
     cell->initPoints(
@@ -904,7 +1937,6 @@ size_t PointCloudGridEncoder::decodeCell(zmq::message_t &msg, CellHeader *c_head
         c_header->point_encoding_y,
         c_header->point_encoding_z
     );
-    cell->points.resize(c_header->num_elements);
 
     // set BitCount and element count for color data
     cell->initColors(
@@ -912,44 +1944,78 @@ size_t PointCloudGridEncoder::decodeCell(zmq::message_t &msg, CellHeader *c_head
             c_header->color_encoding_y,
             c_header->color_encoding_z
     );
-    cell->colors.resize(c_header->num_elements);
+
+    // progressive cells decode a prefix of num_decoded elements,
+    // others are subsampled after decoding all elements
+    bool progressive = ctx.global_header_.progressive;
+    size_t num_unpacked = progressive ? c_header->num_decoded : c_header->num_elements;
+
+    if(isRangeCoded(ctx)) {
+        unsigned coded_size = loadU32(msg + offset);
+        offset += sizeof(unsigned);
+        if(!rangeDecodeCell(msg + offset, coded_size, num_unpacked, cell->points, cell->colors))
+            return 0;
+        subsampleCell(cell, c_header->num_decoded);
+        return offset + coded_size;
+    }
+
+    // extract octree coded positions followed by packed colors
+    if(isOctreeCoded(ctx)) {
+        unsigned coded_size = loadU32(msg + offset);
+        offset += sizeof(unsigned);
+        size_t octree_size = octreeDecodeCell(msg + offset, coded_size, c_header->num_elements, cell->points,
+                                              scratch);
+        if(octree_size == 0 || octree_size + BitVecArray::getByteSize(c_header->num_elements,
+                c_header->color_encoding_x, c_header->color_encoding_y, c_header->color_encoding_z) > coded_size)
+            return 0;
+        cell->colors.unpack(msg + offset + octree_size, c_header->num_elements);
+        subsampleCell(cell, c_header->num_decoded);
+        return offset + coded_size;
+    }
 
     // extract position data
-    size_t bytes_p(cell->points.getByteSize());
-    auto p_arr = new unsigned char[bytes_p];
-    memcpy(p_arr, (unsigned char*) msg.data() + offset, bytes_p);
-    offset += bytes_p;
-    cell->points.unpack(p_arr, c_header->num_elements);
+    cell->points.unpack(msg + offset, num_unpacked);
+    offset += BitVecArray::getByteSize(c_header->num_elements,
+        c_header->point_encoding_x, c_header->point_encoding_y, c_header->point_encoding_z);
 
     // extract color data
-    size_t bytes_c(cell->colors.getByteSize());
-    auto c_arr = new unsigned char[bytes_c];
-    memcpy(c_arr, (unsigned char*) msg.data() + offset, bytes_c);
-    offset += bytes_c;
-    cell->colors.unpack(c_arr, c_header->num_elements);
-
-    // cleanup
-    delete [] p_arr;
-    delete [] c_arr;
+    cell->colors.unpack(msg + offset, num_unpacked);
+    offset += BitVecArray::getByteSize(c_header->num_elements,
+        c_header->color_encoding_x, c_header->color_encoding_y, c_header->color_encoding_z);
 
+    subsampleCell(cell, c_header->num_decoded);
     return offset;
 }
 
-unsigned PointCloudGridEncoder::calcGridCellIndex(const float pos[3], const Vec<float>& cell_range) const {
+unsigned PointCloudGridEncoder::calcGridCellIndex(const Context& ctx, const float pos[3],
+                                                  const Vec<float>& cell_range) const {
     Vec<float> temp(pos[0], pos[1], pos[2]);
-    temp -= pc_grid_->bounding_box.min;
+    temp -= ctx.pc_grid_->bounding_box.min;
     auto x_idx = static_cast<unsigned>(floor(static_cast<double>(temp.x / cell_range.x)));
     auto y_idx = static_cast<unsigned>(floor(static_cast<double>(temp.y / cell_range.y)));
     auto z_idx = static_cast<unsigned>(floor(static_cast<double>(temp.z / cell_range.z)));
     return x_idx +
-           y_idx * pc_grid_->dimensions.x +
-           z_idx * pc_grid_->dimensions.x * pc_grid_->dimensions.y;
+           y_idx * ctx.pc_grid_->dimensions.x +
+           z_idx * ctx.pc_grid_->dimensions.x * ctx.pc_grid_->dimensions.y;
+}
+
+BoundingBox PointCloudGridEncoder::calcGridCellBoundingBox(const Context& ctx, unsigned cell_idx,
+                                                           const Vec<float>& cell_range) const
+{
+    unsigned x_idx = cell_idx % ctx.pc_grid_->dimensions.x;
+    unsigned y_idx = (cell_idx / ctx.pc_grid_->dimensions.x) % ctx.pc_grid_->dimensions.y;
+    unsigned z_idx = cell_idx / (ctx.pc_grid_->dimensions.x * ctx.pc_grid_->dimensions.y);
+    Vec<float> min(ctx.pc_grid_->bounding_box.min.x + x_idx * cell_range.x,
+                   ctx.pc_grid_->bounding_box.min.y + y_idx * cell_range.y,
+                   ctx.pc_grid_->bounding_box.min.z + z_idx * cell_range.z);
+    return BoundingBox(min, min + cell_range);
 }
 
-const Vec<float> PointCloudGridEncoder::mapToCell(const float pos[3], const Vec<float> &cell_range)
+const Vec<float> PointCloudGridEncoder::mapToCell(const Context& ctx, const float pos[3],
+                                                  const Vec<float> &cell_range) const
 {
     Vec<float> cell_pos(pos[0], pos[1], pos[2]);
-    cell_pos -= pc_grid_->bounding_box.min;
+    cell_pos -= ctx.pc_grid_->bounding_box.min;
     float x_steps = cell_pos.x / cell_range.x;
     float y_steps = cell_pos.y / cell_range.y;
     float z_steps = cell_pos.z / cell_range.z;
@@ -964,48 +2030,218 @@ const Vec<float> PointCloudGridEncoder::mapToCell(const float pos[3], const Vec<
     return cell_pos;
 }
 
-size_t PointCloudGridEncoder::calcMessageSize(const std::vector<CellHeader *> & cell_headers) const {
-    // global header size
-    size_t global_header_size = GlobalHeader::getByteSize();
-    // message size
-    size_t message_size = global_header_size;
+size_t PointCloudGridEncoder::calcGridMessageSize(const Context& ctx) const {
     // header size
     size_t header_size = GridHeader::getByteSize();
-    message_size += header_size;
+    size_t message_size = header_size;
 
-    // blacklist size
-    size_t blacklist_size = header_->num_blacklist*sizeof(unsigned);
-    message_size += blacklist_size;
-    if(cell_headers.empty())
-        return message_size;
-    // size of one cell header
-    size_t cell_header_size = CellHeader::getByteSize();
-    // cell header sizes
-    message_size += cell_header_size * cell_headers.size();
+    size_t skiplist_size = 0;
     unsigned num_elements=0;
-    for(auto c_header: cell_headers) {
-        num_elements += c_header->num_elements;
-        // size of elements for one cell
-        message_size += BitVecArray::getByteSize(
-            c_header->num_elements,
-            c_header->point_encoding_x,
-            c_header->point_encoding_y,
-            c_header->point_encoding_z
-        );
-        message_size += BitVecArray::getByteSize(
-                c_header->num_elements,
-                c_header->color_encoding_x,
-                c_header->color_encoding_y,
-                c_header->color_encoding_z
-        );
+    CellHeader c_header, prev_header;
+    bool has_prev = false;
+    for(unsigned cell_idx = 0; cell_idx < ctx.pc_grid_->cells.size(); ++cell_idx) {
+        GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+        if(ctx.arena_.black_cells[cell_idx])
+            continue;
+        // skip list size
+        if(ctx.cell_skipped_[cell_idx]) {
+            skiplist_size += sizeof(unsigned);
+            continue;
+        }
+        num_elements += cell->size();
+        // size of one cell header (& offset table entry) & elements for one cell
+        initCellHeader(ctx, cell_idx, &c_header);
+        message_size += calcCellHeaderSize(ctx, &c_header, has_prev ? &prev_header : nullptr);
+        if(settings.cell_offset_table)
+            message_size += sizeof(unsigned);
+        prev_header = c_header;
+        has_prev = !settings.cell_offset_table;
     }
+    for(unsigned cell_idx = 0; cell_idx < ctx.pc_grid_->cells.size(); ++cell_idx)
+        message_size += calcCellDataSize(ctx, cell_idx);
+    size_t blacklist_size = calcBlackListSize(ctx.arena_.black_cells);
+    message_size += blacklist_size;
+    message_size += skiplist_size;
 
     if(settings.verbose) {
         std::cout << "HEADER SIZE (bytes) " << header_size << std::endl;
         std::cout << "BLACKLIST SIZE (bytes) " << blacklist_size << std::endl;
+        std::cout << "SKIPLIST SIZE (bytes) " << skiplist_size << std::endl;
         std::cout << "CELLS\n";
         std::cout << " > ELEMENT COUNT " << num_elements << std::endl;
     }
 
     return message_size;
 }
+
+size_t PointCloudGridEncoder::calcCellDataSize(const Context& ctx, unsigned cell_idx) const {
+    GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+    if(!isCellSent(ctx, cell_idx))
+        return 0;
+    if(hasPrecodedCells(ctx))
+        return sizeof(unsigned) + ctx.coded_cells_[cell_idx].size();
+    return cell->points.getByteSize() + cell->colors.getByteSize();
+}
+
+size_t PointCloudGridEncoder::calcCellDataSize(const Context& ctx, const unsigned char* msg, const CellHeader* c_header,
+                                               size_t offset) const {
+    if(c_header->num_elements == 0)
+        return 0;
+    if(hasPrecodedCells(ctx)) {
+        // size prefix has to be within message
+        if(offset + sizeof(unsigned) > ctx.global_header_.uncompressed_size)
+            return sizeof(unsigned);
+        unsigned coded_size = loadU32(msg + offset);
+        return sizeof(unsigned) + coded_size;
+    }
+    size_t data_size = BitVecArray::getByteSize(
+            c_header->num_elements,
+            c_header->point_encoding_x,
+            c_header->point_encoding_y,
+            c_header->point_encoding_z
+    );
+    data_size += BitVecArray::getByteSize(
+            c_header->num_elements,
+            c_header->color_encoding_x,
+            c_header->color_encoding_y,
+            c_header->color_encoding_z
+    );
+    return data_size;
+}
+
+bool PointCloudGridEncoder::isRangeCoded(const Context& ctx) const {
+    return ctx.global_header_.entropy_coding && ctx.global_header_.entropy_backend == ENTROPY_RANGE;
+}
+
+bool PointCloudGridEncoder::isOctreeCoded(const Context& ctx) const {
+    return !isRangeCoded(ctx) && ctx.global_header_.geometry_coding == GEOMETRY_OCTREE;
+}
+
+bool PointCloudGridEncoder::hasPrecodedCells(const Context& ctx) const {
+    return isRangeCoded(ctx) || isOctreeCoded(ctx);
+}
+
+void PointCloudGridEncoder::precodeCells(Context& ctx) const {
+    Measure t;
+    t.startWatch();
+
+    ctx.coded_cells_.resize(ctx.pc_grid_->cells.size());
+    parallelForScratch(ctx, ctx.pc_grid_->cells.size(), [this, &ctx](size_t cell_idx, OctreeScratch& scratch) {
+        GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+        // data of cells not sent is kept for cell caching
+        if(!isCellSent(ctx, cell_idx) || ctx.cell_cached_[cell_idx])
+            return;
+        std::vector<unsigned char>& coded = ctx.coded_cells_[cell_idx];
+        coded.clear();
+        if(isRangeCoded(ctx)) {
+            rangeEncodeCell(cell->points, cell->colors, coded);
+            return;
+        }
+        octreeEncodeCell(cell->points, coded, scratch);
+        size_t octree_size = coded.size();
+        coded.resize(octree_size + cell->colors.getByteSize());
+        cell->colors.pack(coded.data() + octree_size);
+    });
+
+    if(isRangeCoded(ctx))
+        ctx.encode_log.entropy_compress_time = t.stopWatch();
+
+    if(settings.verbose) {
+        std::cout << (isRangeCoded(ctx) ? "RANGE" : "OCTREE") << " CODING done." << std::endl;
+        std::cout << "  > took " << t.stopWatch() << "ms." << std::endl;
+    }
+}
+
+void PointCloudGridEncoder::selectSkippedCells(Context& ctx) const {
+    ctx.cell_skipped_.assign(ctx.pc_grid_->cells.size(), 0);
+    ctx.arena_.black_cells.resize(ctx.pc_grid_->cells.size());
+    for(unsigned cell_idx = 0; cell_idx < ctx.pc_grid_->cells.size(); ++cell_idx)
+        ctx.arena_.black_cells[cell_idx] = ctx.pc_grid_->cells[cell_idx]->size() == 0;
+
+    // delta frames require the grid layout of the reference frame
+    bool same_grid = ctx.ref_grid_valid_ &&
+                     ctx.ref_grid_->dimensions == ctx.pc_grid_->dimensions &&
+                     sameBoundingBox(ctx.ref_grid_->bounding_box, ctx.pc_grid_->bounding_box);
+    ctx.header_.delta_frame = settings.keyframe_interval > 1 && same_grid &&
+                           ctx.frames_since_keyframe_ + 1 < settings.keyframe_interval;
+    ctx.header_.frame_idx = ctx.next_frame_idx_++;
+    ctx.frames_since_keyframe_ = ctx.header_.delta_frame ? ctx.frames_since_keyframe_ + 1 : 0;
+    if(!ctx.header_.delta_frame)
+        return;
+
+    parallelFor(0, ctx.pc_grid_->cells.size(), [this, &ctx](size_t cell_idx) {
+        GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+        GridCell* ref_cell = ctx.ref_grid_->cells[cell_idx];
+        if(cell->size() > 0 &&
+           similarArrays(cell->points, ref_cell->points, settings.skip_tolerance) &&
+           similarArrays(cell->colors, ref_cell->colors, settings.skip_tolerance))
+            ctx.cell_skipped_[cell_idx] = 1;
+    }, 1);
+}
+
+void PointCloudGridEncoder::updateReferenceGrid(Context& ctx) const {
+    if(settings.keyframe_interval <= 1) {
+        ctx.ref_grid_valid_ = false;
+        return;
+    }
+    if(!ctx.header_.delta_frame) {
+        ctx.ref_grid_->resize(ctx.pc_grid_->dimensions);
+        ctx.ref_grid_->bounding_box = ctx.pc_grid_->bounding_box;
+    }
+
+    // skipped cells keep the content known to the decoder
+    parallelFor(0, ctx.pc_grid_->cells.size(), [&ctx](size_t cell_idx) {
+        if(!ctx.cell_skipped_[cell_idx])
+            *ctx.ref_grid_->cells[cell_idx] = *ctx.pc_grid_->cells[cell_idx];
+    }, 1);
+    ctx.ref_grid_valid_ = true;
+}
+
+bool PointCloudGridEncoder::isCellSent(const Context& ctx, unsigned cell_idx) const {
+    return ctx.pc_grid_->cells[cell_idx]->size() > 0 && !ctx.cell_skipped_[cell_idx];
+}
+
+void PointCloudGridEncoder::hashCells(Context& ctx) const {
+    size_t num_cells = ctx.pc_grid_->cells.size();
+    ctx.cell_cached_.assign(num_cells, 0);
+    if(!settings.cell_caching) {
+        ctx.cell_hashes_.clear();
+        ctx.packed_cells_.clear();
+        ctx.cache_grid_->resize(Vec8(1,1,1));
+        return;
+    }
+
+    // cached data of other encoding is invalid
+    if(ctx.cache_range_coded_ != isRangeCoded(ctx) || ctx.cache_octree_coded_ != isOctreeCoded(ctx) ||
+       ctx.cell_hashes_.size() != num_cells) {
+        ctx.cell_hashes_.assign(num_cells, 0);
+        ctx.cache_grid_->resize(ctx.pc_grid_->dimensions);
+        ctx.packed_cells_.resize(num_cells);
+        ctx.coded_cells_.resize(num_cells);
+        for(auto& packed : ctx.packed_cells_)
+            packed.clear();
+        for(auto& coded : ctx.coded_cells_)
+            coded.clear();
+        ctx.cache_range_coded_ = isRangeCoded(ctx);
+        ctx.cache_octree_coded_ = isOctreeCoded(ctx);
+    }
+
+    // hash 0 marks cells without cached data,
+    // equal hashes are confirmed by comparing the content
+    parallelFor(0, num_cells, [this, &ctx](size_t cell_idx) {
+        if(!isCellSent(ctx, cell_idx))
+            return;
+        GridCell* cell = ctx.pc_grid_->cells[cell_idx];
+        GridCell* cached_cell = ctx.cache_grid_->cells[cell_idx];
+        uint64_t hash = hashArray(cell->colors, hashArray(cell->points, 0));
+        hash = hash == 0 ? 1 : hash;
+        if(hash == ctx.cell_hashes_[cell_idx] &&
+           similarArrays(cell->points, cached_cell->points, 0) &&
+           similarArrays(cell->colors, cached_cell->colors, 0)) {
+            ctx.cell_cached_[cell_idx] = 1;
+            return;
+        }
+        ctx.cell_hashes_[cell_idx] = hash;
+        *cached_cell = *cell;
+    }, 1);
+}
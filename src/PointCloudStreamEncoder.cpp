@@ -0,0 +1,206 @@
+#include "PointCloudStreamEncoder.hpp"
+
+#include <algorithm>
+
+PointCloudStreamEncoder::Frame::Frame()
+    : state(FRAME_FREE)
+    , grid(new PointCloudGrid(Vec8(1,1,1)))
+    , valid(false)
+    , delta_frame(false)
+    , coder(nullptr)
+{}
+
+PointCloudStreamEncoder::PointCloudStreamEncoder(const PointCloudGridEncoder::EncodingSettings& s,
+                                                 unsigned max_frames, ThreadPool* pool)
+    : builder_(s)
+    , packer_(s)
+    , compressor_(s)
+    , reference_lost_(false)
+    , frames_(std::max(max_frames, 1u))
+    , push_idx_(0)
+    , pop_idx_(0)
+    , closed_(false)
+    , stopped_(false)
+    , keyframe_requested_(false)
+{
+    // stage threads run loops along with the workers, thus each stage
+    // gets a third of the pool instead of oversubscribing it threefold
+    unsigned num_threads = pool != nullptr ? pool->getNumThreads() : ThreadPool::getDefault().getNumThreads();
+    for(PointCloudGridEncoder* encoder : {&builder_, &packer_, &compressor_}) {
+        encoder->setThreadPool(pool);
+        encoder->max_loop_threads_ = std::max((num_threads + 2) / 3, 1u);
+    }
+    stages_.emplace_back(&PointCloudStreamEncoder::runStage, this, FRAME_PUSHED, FRAME_BUILT);
+    stages_.emplace_back(&PointCloudStreamEncoder::runStage, this, FRAME_BUILT, FRAME_PACKED);
+    stages_.emplace_back(&PointCloudStreamEncoder::runStage, this, FRAME_PACKED, FRAME_ENCODED);
+}
+
+PointCloudStreamEncoder::~PointCloudStreamEncoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        stopped_ = true;
+    }
+    state_cv_.notify_all();
+    for(std::thread& stage : stages_)
+        stage.join();
+    for(Frame& frame : frames_)
+        delete frame.grid;
+}
+
+bool PointCloudStreamEncoder::push(const std::vector<UncompressedVoxel>& point_cloud, int num_points)
+{
+    Frame* frame = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        state_cv_.wait(lock, [this] { return closed_ || frames_[push_idx_].state == FRAME_FREE; });
+        if(closed_)
+            return false;
+        frame = &frames_[push_idx_];
+        frame->state = FRAME_FILLING;
+        push_idx_ = (push_idx_ + 1) % frames_.size();
+    }
+
+    // copy outside of lock, frame is reserved for this call
+    size_t size = num_points < 0 ? point_cloud.size() : std::min(point_cloud.size(), size_t(num_points));
+    frame->points.assign(point_cloud.begin(), point_cloud.begin() + size);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frame->state = FRAME_PUSHED;
+    }
+    state_cv_.notify_all();
+    return true;
+}
+
+bool PointCloudStreamEncoder::pop(zmq::message_t& msg)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    state_cv_.wait(lock, [this] {
+        FrameState state = frames_[pop_idx_].state;
+        return state == FRAME_ENCODED || (closed_ && state == FRAME_FREE);
+    });
+    if(frames_[pop_idx_].state != FRAME_ENCODED)
+        return false;
+    popFrame(lock, msg);
+    return true;
+}
+
+bool PointCloudStreamEncoder::tryPop(zmq::message_t& msg)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(frames_[pop_idx_].state != FRAME_ENCODED)
+        return false;
+    popFrame(lock, msg);
+    return true;
+}
+
+void PointCloudStreamEncoder::popFrame(std::unique_lock<std::mutex>& lock, zmq::message_t& msg)
+{
+    Frame& frame = frames_[pop_idx_];
+    frame.state = FRAME_POPPING;
+    pop_idx_ = (pop_idx_ + 1) % frames_.size();
+    lock.unlock();
+
+    msg = std::move(frame.msg);
+
+    lock.lock();
+    frame.state = FRAME_FREE;
+    state_cv_.notify_all();
+}
+
+void PointCloudStreamEncoder::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    state_cv_.notify_all();
+}
+
+void PointCloudStreamEncoder::requestKeyframe()
+{
+    keyframe_requested_ = true;
+}
+
+const PointCloudGridEncoder::EncodingSettings& PointCloudStreamEncoder::getSettings() const
+{
+    return packer_.settings;
+}
+
+void PointCloudStreamEncoder::runStage(FrameState input, FrameState output)
+{
+    for(size_t idx = 0;; idx = (idx + 1) % frames_.size()) {
+        Frame& frame = frames_[idx];
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            state_cv_.wait(lock, [this, &frame, input] { return stopped_ || frame.state == input; });
+            if(stopped_)
+                return;
+        }
+
+        if(input == FRAME_PUSHED)
+            buildFrame(frame);
+        else if(input == FRAME_BUILT)
+            packFrame(frame);
+        else
+            compressFrame(frame);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            frame.state = output;
+        }
+        state_cv_.notify_all();
+    }
+}
+
+void PointCloudStreamEncoder::buildFrame(Frame& frame)
+{
+    std::swap(builder_ctx_.pc_grid_, frame.grid);
+    builder_.buildPointCloudGrid(builder_ctx_, frame.points, -1, builder_.settings.grid_precision);
+    std::swap(builder_ctx_.pc_grid_, frame.grid);
+}
+
+void PointCloudStreamEncoder::packFrame(Frame& frame)
+{
+    if(keyframe_requested_.exchange(false))
+        packer_ctx_.requestKeyframe();
+
+    std::swap(packer_ctx_.pc_grid_, frame.grid);
+    frame.valid = packer_.prepareGridMessage(packer_ctx_, &frame.coder);
+    if(frame.valid) {
+        size_t grid_size = packer_.calcGridMessageSize(packer_ctx_);
+        frame.grid_message.resize(grid_size);
+        packer_.encodePointCloudGrid(packer_ctx_, frame.grid_message.data());
+        // the next frame is packed before this one is compressed,
+        // compressFrame drops deltas referring to a frame that failed
+        packer_.updateReferenceGrid(packer_ctx_);
+        frame.delta_frame = packer_ctx_.header_.delta_frame;
+        frame.header = packer_ctx_.global_header_;
+        // offsets of the next frame are written into the vector of this one
+        frame.cell_offsets.swap(packer_ctx_.arena_.cell_offsets);
+    }
+    std::swap(packer_ctx_.pc_grid_, frame.grid);
+}
+
+void PointCloudStreamEncoder::compressFrame(Frame& frame)
+{
+    if(!frame.valid) {
+        frame.msg = zmq::message_t();
+        return;
+    }
+    if(!frame.delta_frame)
+        reference_lost_ = false;
+    else if(reference_lost_) {
+        frame.msg = zmq::message_t();
+        return;
+    }
+    frame.msg = compressor_.encodeGridMessage(compressor_ctx_, frame.header, frame.coder, frame.grid_message.data(),
+                                              frame.grid_message.size(), frame.cell_offsets);
+    // frames packed later might refer to the lost one
+    if(frame.msg.size() == 0) {
+        reference_lost_ = true;
+        keyframe_requested_ = true;
+    }
+}
@@ -0,0 +1,60 @@
+#include "RadixSort.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+void radixSort(std::vector<KeyValuePair>& data, RadixSortScratch& scratch, unsigned key_bits,
+               ThreadPool& pool, unsigned num_threads)
+{
+    const unsigned RADIX_BITS = 8;
+    const size_t RADIX = size_t(1) << RADIX_BITS;
+
+    size_t n = data.size();
+    scratch.buffer.resize(n);
+    if(n < 2)
+        return;
+
+    size_t num_blocks = std::max(std::min<size_t>(num_threads, n), size_t(1));
+    std::vector<size_t>& histograms = scratch.histograms;
+    histograms.resize(num_blocks * RADIX);
+    KeyValuePair* src = data.data();
+    KeyValuePair* dst = scratch.buffer.data();
+    bool sorted_in_scratch = false;
+
+    for(unsigned shift = 0; shift < key_bits; shift += RADIX_BITS) {
+        std::fill(histograms.begin(), histograms.end(), 0);
+
+        pool.parallelFor(0, num_blocks, num_threads, [&](size_t b) {
+            size_t* hist = &histograms[b * RADIX];
+            for(size_t i = n * b / num_blocks; i < n * (b + 1) / num_blocks; ++i)
+                hist[(src[i].key >> shift) & (RADIX - 1)] += 1;
+        }, 1);
+
+        // exclusive prefix sum ordered by digit, then block
+        bool skip = false;
+        size_t sum = 0;
+        for(size_t d = 0; d < RADIX && !skip; ++d) {
+            size_t digit_begin = sum;
+            for(size_t b = 0; b < num_blocks; ++b) {
+                size_t count = histograms[b * RADIX + d];
+                histograms[b * RADIX + d] = sum;
+                sum += count;
+            }
+            skip = sum - digit_begin == n;
+        }
+        if(skip)
+            continue;
+
+        pool.parallelFor(0, num_blocks, num_threads, [&](size_t b) {
+            size_t* hist = &histograms[b * RADIX];
+            for(size_t i = n * b / num_blocks; i < n * (b + 1) / num_blocks; ++i)
+                dst[hist[(src[i].key >> shift) & (RADIX - 1)]++] = src[i];
+        }, 1);
+
+        std::swap(src, dst);
+        sorted_in_scratch = !sorted_in_scratch;
+    }
+
+    if(sorted_in_scratch)
+        data.swap(scratch.buffer);
+}
@@ -0,0 +1,195 @@
+#include "RangeCoder.hpp"
+
+#include <algorithm>
+
+// definitions of constants odr-used by std::fill
+const unsigned RangeEncoder::PROB_BITS;
+const BitProb RangeEncoder::PROB_INIT;
+const unsigned RangeEncoder::ADAPT_SHIFT;
+
+namespace {
+
+const unsigned MAX_COMPONENT_BITS = 32;
+
+/**
+ * Bit lengths of residuals in range [0,MAX_COMPONENT_BITS]
+ * are coded by a binary tree of at most this depth.
+*/
+const unsigned LENGTH_TREE_BITS = 6;
+
+/**
+ * Upper bound of output bits per binary decision,
+ * given by the smallest reachable BitProb.
+*/
+const size_t MAX_BITS_PER_DECISION = 7;
+
+/**
+ * Upper bound of binary decisions per output byte, given by the largest
+ * reachable BitProb of 2017/2048, which costs more than 0.022 bits.
+*/
+const size_t MAX_DECISIONS_PER_BYTE = 364;
+
+/**
+ * Depth of the binary tree coding bit lengths in range [0,bits].
+*/
+unsigned calcLengthTreeBits(unsigned bits)
+{
+    unsigned tree_bits = 1;
+    while((1u << tree_bits) <= bits)
+        ++tree_bits;
+    return tree_bits;
+}
+
+/**
+ * Adaptive model for residuals of one component.
+ * Bits below the leading one are modeled per bit length & bit position.
+*/
+struct ResidualModel {
+    ResidualModel()
+    {
+        std::fill(&length[0], &length[0] + (1 << LENGTH_TREE_BITS), RangeEncoder::PROB_INIT);
+        std::fill(&bits[0][0], &bits[0][0] + (MAX_COMPONENT_BITS + 1) * MAX_COMPONENT_BITS,
+                  RangeEncoder::PROB_INIT);
+    }
+
+    BitProb length[1 << LENGTH_TREE_BITS];
+    BitProb bits[MAX_COMPONENT_BITS + 1][MAX_COMPONENT_BITS];
+};
+
+enum ModelIdx {
+    MODEL_Z,
+    MODEL_Y_SAME_Z,
+    MODEL_Y,
+    MODEL_X_SAME_ZY,
+    MODEL_X,
+    MODEL_CLR_X,
+    MODEL_CLR_Y,
+    MODEL_CLR_Z,
+    NUM_MODELS
+};
+
+/**
+ * Residual of value to prev within [0,2^bits).
+ * Signed residuals are zigzag mapped, such that small negative
+ * differences yield small residuals as well.
+*/
+uint64_t toResidual(uint64_t value, uint64_t prev, unsigned bits, bool is_signed)
+{
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    uint64_t diff = (value - prev) & mask;
+    if(!is_signed)
+        return diff;
+    uint64_t half = uint64_t(1) << (bits - 1);
+    return diff < half ? diff << 1 : (((mask - diff) << 1) | 1);
+}
+
+uint64_t fromResidual(uint64_t residual, uint64_t prev, unsigned bits, bool is_signed)
+{
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    uint64_t diff = residual;
+    if(is_signed)
+        diff = (residual & 1) == 0 ? residual >> 1 : mask - (residual >> 1);
+    return (prev + diff) & mask;
+}
+
+/**
+ * Codes residual of a component of given bits.
+*/
+void encodeResidual(RangeEncoder& enc, ResidualModel& m, uint64_t residual, unsigned bits)
+{
+    unsigned len = 0;
+    while(len < 64 && (residual >> len) != 0)
+        ++len;
+    unsigned node = 1;
+    for(int i = static_cast<int>(calcLengthTreeBits(bits)) - 1; i >= 0; --i) {
+        unsigned bit = (len >> i) & 1;
+        enc.encodeBit(m.length[node], bit);
+        node = (node << 1) | bit;
+    }
+    for(int i = static_cast<int>(len) - 2; i >= 0; --i)
+        enc.encodeBit(m.bits[len][i], static_cast<unsigned>(residual >> i) & 1);
+}
+
+uint64_t decodeResidual(RangeDecoder& dec, ResidualModel& m, unsigned bits)
+{
+    unsigned tree_bits = calcLengthTreeBits(bits);
+    unsigned node = 1;
+    for(unsigned i = 0; i < tree_bits; ++i)
+        node = (node << 1) | dec.decodeBit(m.length[node]);
+    unsigned len = node - (1 << tree_bits);
+    if(len == 0)
+        return 0;
+    // corrupted input, clamp to valid contexts
+    len = std::min(len, bits);
+    uint64_t residual = 1;
+    for(int i = static_cast<int>(len) - 2; i >= 0; --i)
+        residual = (residual << 1) | dec.decodeBit(m.bits[len][i]);
+    return residual;
+}
+
+} // namespace
+
+void rangeEncodeCell(const BitVecArray& points, const BitVecArray& colors,
+                     std::vector<unsigned char>& out)
+{
+    ResidualModel models[NUM_MODELS];
+    RangeEncoder enc(out);
+    Vec<uint64_t> prev_p(0,0,0), prev_c(0,0,0);
+    unsigned px = points.getNX(), py = points.getNY(), pz = points.getNZ();
+    unsigned cx = colors.getNX(), cy = colors.getNY(), cz = colors.getNZ();
+    for(unsigned i = 0; i < points.size(); ++i) {
+        Vec<uint64_t> p = points[i];
+        Vec<uint64_t> c = colors[i];
+        bool same_z = p.z == prev_p.z;
+        bool same_zy = same_z && p.y == prev_p.y;
+        encodeResidual(enc, models[MODEL_Z], toResidual(p.z, prev_p.z, pz, false), pz);
+        encodeResidual(enc, models[same_z ? MODEL_Y_SAME_Z : MODEL_Y], toResidual(p.y, prev_p.y, py, !same_z), py);
+        encodeResidual(enc, models[same_zy ? MODEL_X_SAME_ZY : MODEL_X], toResidual(p.x, prev_p.x, px, !same_zy), px);
+        encodeResidual(enc, models[MODEL_CLR_X], toResidual(c.x, prev_c.x, cx, true), cx);
+        encodeResidual(enc, models[MODEL_CLR_Y], toResidual(c.y, prev_c.y, cy, true), cy);
+        encodeResidual(enc, models[MODEL_CLR_Z], toResidual(c.z, prev_c.z, cz, true), cz);
+        prev_p = p;
+        prev_c = c;
+    }
+    enc.flush();
+}
+
+bool rangeDecodeCell(const unsigned char* data, size_t size, size_t num_elmnts,
+                     BitVecArray& points, BitVecArray& colors)
+{
+    // every element codes at least one decision per component
+    if(num_elmnts > size * MAX_DECISIONS_PER_BYTE / 6)
+        return false;
+    ResidualModel models[NUM_MODELS];
+    RangeDecoder dec(data, size);
+    points.resize(static_cast<unsigned>(num_elmnts));
+    colors.resize(static_cast<unsigned>(num_elmnts));
+    Vec<uint64_t> p(0,0,0), c(0,0,0);
+    unsigned px = points.getNX(), py = points.getNY(), pz = points.getNZ();
+    unsigned cx = colors.getNX(), cy = colors.getNY(), cz = colors.getNZ();
+    for(unsigned i = 0; i < num_elmnts; ++i) {
+        uint64_t z = fromResidual(decodeResidual(dec, models[MODEL_Z], pz), p.z, pz, false);
+        bool same_z = z == p.z;
+        ResidualModel& y_model = models[same_z ? MODEL_Y_SAME_Z : MODEL_Y];
+        uint64_t y = fromResidual(decodeResidual(dec, y_model, py), p.y, py, !same_z);
+        bool same_zy = same_z && y == p.y;
+        ResidualModel& x_model = models[same_zy ? MODEL_X_SAME_ZY : MODEL_X];
+        uint64_t x = fromResidual(decodeResidual(dec, x_model, px), p.x, px, !same_zy);
+        p = Vec<uint64_t>(x, y, z);
+        c.x = fromResidual(decodeResidual(dec, models[MODEL_CLR_X], cx), c.x, cx, true);
+        c.y = fromResidual(decodeResidual(dec, models[MODEL_CLR_Y], cy), c.y, cy, true);
+        c.z = fromResidual(decodeResidual(dec, models[MODEL_CLR_Z], cz), c.z, cz, true);
+        points.set(i, p);
+        colors.set(i, c);
+        if(dec.isOverrun())
+            return false;
+    }
+    return true;
+}
+
+size_t calcMaxRangeCodedSize(size_t num_elmnts, size_t elmnt_bits)
+{
+    // 6 components, each coding its length plus at most one decision per bit
+    size_t decisions = num_elmnts * (6 * LENGTH_TREE_BITS + elmnt_bits);
+    return (decisions * MAX_BITS_PER_DECISION + 7) / 8 + 5;
+}
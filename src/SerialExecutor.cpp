@@ -0,0 +1,54 @@
+#include "SerialExecutor.hpp"
+
+#include <exception>
+#include <iostream>
+#include <utility>
+
+SerialExecutor::SerialExecutor()
+    : stop_(false)
+{
+    thread_ = std::thread(&SerialExecutor::work, this);
+}
+
+SerialExecutor::~SerialExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    task_cv_.notify_one();
+    thread_.join();
+}
+
+void SerialExecutor::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    task_cv_.notify_one();
+}
+
+void SerialExecutor::work()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true) {
+        task_cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if(tasks_.empty())
+            return;
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        // an escaping exception must not end the thread and with it the process
+        try {
+            task();
+        }
+        catch(const std::exception& e) {
+            std::cout << "FAILURE: asynchronous task failed: " << e.what() << std::endl;
+        }
+        catch(...) {
+            std::cout << "FAILURE: asynchronous task failed." << std::endl;
+        }
+        lock.lock();
+    }
+}
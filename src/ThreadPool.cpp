@@ -0,0 +1,138 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned num_threads)
+    : queue_head_(nullptr)
+    , queue_tail_(nullptr)
+    , stop_(false)
+{
+    if(num_threads == 0)
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    workers_.reserve(num_threads - 1);
+    for(unsigned i = 1; i < num_threads; ++i)
+        workers_.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for(std::thread& worker : workers_)
+        worker.join();
+}
+
+unsigned ThreadPool::getNumThreads() const
+{
+    return static_cast<unsigned>(workers_.size()) + 1;
+}
+
+ThreadPool& ThreadPool::getDefault()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::run(Loop& loop, size_t begin, unsigned max_threads)
+{
+    unsigned num_threads = getNumThreads();
+    if(max_threads > 0)
+        num_threads = std::min(num_threads, max_threads);
+    size_t num_indexes = loop.end - begin;
+    if(loop.grain == 0)
+        loop.grain = std::max<size_t>(1, num_indexes / (4 * size_t(num_threads)));
+    size_t num_tasks = (num_indexes + loop.grain - 1) / loop.grain;
+
+    loop.next = begin;
+    loop.failed = false;
+    loop.max_helpers = static_cast<unsigned>(std::min<size_t>(num_threads - 1, num_tasks - 1));
+    loop.num_helpers = 0;
+    loop.num_running = 0;
+    loop.queued = false;
+    loop.next_queued = nullptr;
+
+    // offer loop to idle workers
+    if(loop.max_helpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            loop.queued = true;
+            if(queue_tail_ != nullptr)
+                queue_tail_->next_queued = &loop;
+            else
+                queue_head_ = &loop;
+            queue_tail_ = &loop;
+        }
+        if(loop.max_helpers == 1)
+            work_cv_.notify_one();
+        else
+            work_cv_.notify_all();
+    }
+
+    runTasks(loop);
+
+    // all tasks are claimed, wait for helpers still running theirs
+    if(loop.max_helpers > 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(loop.queued)
+            dequeue(&loop);
+        done_cv_.wait(lock, [&loop] { return loop.num_running == 0; });
+    }
+}
+
+void ThreadPool::work()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true) {
+        work_cv_.wait(lock, [this] { return stop_ || queue_head_ != nullptr; });
+        if(queue_head_ == nullptr)
+            return;
+        Loop* loop = queue_head_;
+        loop->num_running += 1;
+        loop->num_helpers += 1;
+        if(loop->num_helpers == loop->max_helpers)
+            dequeue(loop);
+        lock.unlock();
+
+        runTasks(*loop);
+
+        lock.lock();
+        // loop may be left by its caller once notified
+        loop->num_running -= 1;
+        if(loop->num_running == 0)
+            done_cv_.notify_all();
+    }
+}
+
+void ThreadPool::dequeue(Loop* loop)
+{
+    Loop* prev = nullptr;
+    for(Loop* it = queue_head_; it != loop; it = it->next_queued)
+        prev = it;
+    if(prev != nullptr)
+        prev->next_queued = loop->next_queued;
+    else
+        queue_head_ = loop->next_queued;
+    if(queue_tail_ == loop)
+        queue_tail_ = prev;
+    loop->queued = false;
+}
+
+void ThreadPool::runTasks(Loop& loop)
+{
+    while(true) {
+        size_t task_begin = loop.next.fetch_add(loop.grain);
+        if(task_begin >= loop.end)
+            return;
+        try {
+            loop.invoke(loop.fn, task_begin, std::min(task_begin + loop.grain, loop.end));
+        }
+        catch(...) {
+            if(!loop.failed.exchange(true))
+                loop.error = std::current_exception();
+            loop.next = loop.end;
+        }
+    }
+}